@@ -0,0 +1,149 @@
+#include "Pool.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace Dendrite {
+namespace {
+constexpr size_t MIN_CLASS_BYTES = POOL_ALIGNMENT;
+constexpr size_t SUB_CLASSES = 4; // classes per power of two
+// Up to here classes are POOL_ALIGNMENT apart; quarter steps would be
+// rounded to the same blocks anyway
+constexpr size_t SMALL_CLASS_BYTES = SUB_CLASSES * MIN_CLASS_BYTES;
+constexpr size_t NUM_DOUBLINGS = 20; // 256 B .. 256 MB
+constexpr size_t NUM_CLASSES = SUB_CLASSES + NUM_DOUBLINGS * SUB_CLASSES;
+constexpr size_t MAX_CACHED_PER_CLASS = 64;
+// Per thread, so a thread that once held big buffers (a large evaluation,
+// say) doesn't keep them for good
+constexpr size_t MAX_CACHED_BYTES = size_t(64) << 20;
+
+std::atomic<bool> s_enabled{true};
+std::atomic<size_t> s_allocations{0};
+std::atomic<size_t> s_systemAllocations{0};
+
+// Smallest class that fits bytes, or NUM_CLASSES if none does. Classes are
+// 64, 128, 192 and 256 B, then grow as 256 * 2^d * (1 + q / 4) for
+// doubling d and quarter step q.
+size_t size_class(size_t bytes) {
+  if (bytes <= SMALL_CLASS_BYTES)
+    return bytes == 0 ? 0 : (bytes - 1) / MIN_CLASS_BYTES;
+
+  // bytes lies in (base, 2 * base] for base = 256 * 2^d
+  const size_t d = 63 - __builtin_clzll((bytes - 1) / SMALL_CLASS_BYTES);
+  const size_t base = SMALL_CLASS_BYTES << d;
+  const size_t step = base / SUB_CLASSES;
+  const size_t q = (bytes - base + step - 1) / step; // 1..4
+  const size_t cls = SUB_CLASSES + d * SUB_CLASSES + q - 1;
+  return cls < NUM_CLASSES ? cls : NUM_CLASSES;
+}
+
+size_t class_bytes(size_t cls) {
+  if (cls < SUB_CLASSES)
+    return (cls + 1) * MIN_CLASS_BYTES;
+
+  cls -= SUB_CLASSES;
+  const size_t base = SMALL_CLASS_BYTES << (cls / SUB_CLASSES);
+  return base + (cls % SUB_CLASSES + 1) * (base / SUB_CLASSES);
+}
+
+void *system_alloc(size_t bytes) {
+  s_systemAllocations.fetch_add(1, std::memory_order_relaxed);
+  // aligned_alloc wants a multiple of the alignment
+  bytes = (bytes + POOL_ALIGNMENT - 1) / POOL_ALIGNMENT * POOL_ALIGNMENT;
+  void *ptr = std::aligned_alloc(POOL_ALIGNMENT, bytes);
+  if (ptr == nullptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+struct ThreadCache {
+  std::vector<void *> freeLists[NUM_CLASSES];
+  size_t bytes = 0; // held on the free lists
+
+  void trim() {
+    for (std::vector<void *> &list : freeLists) {
+      for (void *ptr : list)
+        std::free(ptr);
+      list.clear();
+    }
+    bytes = 0;
+  }
+
+  ~ThreadCache();
+};
+
+// Set once the cache is destroyed at thread exit. Matrices that die later
+// (e.g. statics) then free straight to the system.
+thread_local bool t_cacheDead = false;
+thread_local ThreadCache t_cache;
+
+ThreadCache::~ThreadCache() {
+  trim();
+  t_cacheDead = true;
+}
+} // namespace
+
+void *pool_alloc(size_t bytes) {
+  s_allocations.fetch_add(1, std::memory_order_relaxed);
+#ifdef DENDRITE_NO_POOL
+  return system_alloc(bytes);
+#else
+  const size_t cls = size_class(bytes);
+  if (cls == NUM_CLASSES)
+    return system_alloc(bytes);
+
+  if (s_enabled.load(std::memory_order_relaxed) && !t_cacheDead) {
+    std::vector<void *> &list = t_cache.freeLists[cls];
+    if (!list.empty()) {
+      void *ptr = list.back();
+      list.pop_back();
+      t_cache.bytes -= class_bytes(cls);
+      return ptr;
+    }
+  }
+  // rounded up even when disabled, so any block can be cached on free
+  return system_alloc(class_bytes(cls));
+#endif
+}
+
+void pool_free(void *ptr, size_t bytes) {
+  if (ptr == nullptr)
+    return;
+#ifndef DENDRITE_NO_POOL
+  const size_t cls = size_class(bytes);
+  if (cls < NUM_CLASSES && s_enabled.load(std::memory_order_relaxed) &&
+      !t_cacheDead) {
+    std::vector<void *> &list = t_cache.freeLists[cls];
+    const size_t blockBytes = class_bytes(cls);
+    if (list.size() < MAX_CACHED_PER_CLASS &&
+        t_cache.bytes + blockBytes <= MAX_CACHED_BYTES) {
+      list.push_back(ptr);
+      t_cache.bytes += blockBytes;
+      return;
+    }
+  }
+#endif
+  std::free(ptr);
+}
+
+void set_pool_enabled(bool enabled) { s_enabled.store(enabled); }
+
+bool pool_enabled() {
+#ifdef DENDRITE_NO_POOL
+  return false;
+#else
+  return s_enabled.load();
+#endif
+}
+
+void pool_trim() {
+  if (!t_cacheDead)
+    t_cache.trim();
+}
+
+PoolStats pool_stats() {
+  return {s_allocations.load(std::memory_order_relaxed),
+          s_systemAllocations.load(std::memory_order_relaxed)};
+}
+} // namespace Dendrite
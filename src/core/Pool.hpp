@@ -0,0 +1,59 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <cstddef>
+#include <vector>
+
+namespace Dendrite {
+constexpr size_t POOL_ALIGNMENT = 64; // cache line, and one AVX-512 register
+
+// Size-class pool for numeric buffers. Every block is POOL_ALIGNMENT
+// aligned. Freed blocks go onto the freeing thread's free list for their
+// size class and are handed out again without touching malloc. Requests are
+// rounded up to the nearest class (64 B steps up to 256 B, then 4 classes
+// per power of two, at most 25% slack). Blocks beyond the largest class go
+// straight to the system, and so do blocks freed while the thread already
+// caches 64 MB.
+//
+// Pooling can be switched off at runtime with set_pool_enabled(false), or at
+// compile time with DENDRITE_NO_POOL. Blocks are rounded to their class
+// either way, so it's fine to toggle the pool while blocks are alive.
+void *pool_alloc(size_t bytes);
+void pool_free(void *ptr, size_t bytes);
+
+void set_pool_enabled(bool enabled);
+bool pool_enabled();
+
+// Drops the calling thread's cached blocks back to the system
+void pool_trim();
+
+struct PoolStats {
+  size_t allocations;       // pool_alloc calls
+  size_t systemAllocations; // calls that had to go to aligned_alloc
+};
+
+PoolStats pool_stats(); // process wide, counted since startup
+
+// std allocator adaptor so containers can draw from the pool
+template <typename T> class PoolAllocator {
+public:
+  typedef T value_type;
+
+  PoolAllocator() = default;
+  template <typename U> PoolAllocator(const PoolAllocator<U> &) {}
+
+  T *allocate(size_t n) { return static_cast<T *>(pool_alloc(n * sizeof(T))); }
+  void deallocate(T *ptr, size_t n) { pool_free(ptr, n * sizeof(T)); }
+
+  template <typename U> bool operator==(const PoolAllocator<U> &) const {
+    return true;
+  }
+  template <typename U> bool operator!=(const PoolAllocator<U> &) const {
+    return false;
+  }
+};
+
+template <typename T> using PoolVector = std::vector<T, PoolAllocator<T>>;
+} // namespace Dendrite
+
+#endif // !POOL_H
@@ -0,0 +1,163 @@
+#include "ThreadPool.hpp"
+#include <cstdlib>
+#include <memory>
+#include <utility>
+
+namespace Dendrite {
+namespace {
+thread_local bool t_inWorker = false;
+
+// thread_pool() only reads s_current; the mutex serializes replacing the
+// pool, see set_num_threads()
+std::once_flag s_poolOnce;
+std::mutex s_poolMutex;
+std::unique_ptr<ThreadPool> s_pool;
+std::atomic<ThreadPool *> s_current{nullptr};
+
+size_t default_num_threads() {
+  const char *env = std::getenv("DENDRITE_NUM_THREADS");
+  if (env != nullptr && std::atoi(env) > 0)
+    return std::atoi(env);
+
+  const size_t hw = std::thread::hardware_concurrency();
+  return hw > 0 ? hw : 1;
+}
+} // namespace
+
+ThreadPool::ThreadPool(size_t numThreads) {
+  for (size_t i = 1; i < numThreads; i++) {
+    m_workers.emplace_back(&ThreadPool::worker_loop, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  for (std::thread &worker : m_workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::worker_loop() {
+  t_inWorker = true;
+  uint64_t seen = 0;
+
+  while (true) {
+    const void *job;
+    void (*invoke)(const void *, size_t);
+    size_t jobSize;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+      if (m_stop)
+        return;
+      seen = m_generation;
+      job = m_job;
+      invoke = m_invoke;
+      jobSize = m_jobSize;
+    }
+
+    size_t i;
+    try {
+      while ((i = m_next.fetch_add(1)) < jobSize) {
+        invoke(job, i);
+      }
+    } catch (...) {
+      // the first error is rethrown by parallel_for, the rest is skipped
+      m_next = jobSize;
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (!m_error)
+        m_error = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (--m_active == 0)
+      m_done.notify_one();
+  }
+}
+
+void ThreadPool::run(size_t n, const void *job,
+                     void (*invoke)(const void *, size_t)) {
+  std::unique_lock<std::mutex> submit(m_submitMutex, std::try_to_lock);
+  if (m_workers.empty() || n <= 1 || t_inWorker || !submit.owns_lock()) {
+    // tasks run inline are pool tasks too, so parallel code inside them
+    // (a GEMM split into one block, say) stays serial instead of recursing
+    struct InlineGuard {
+      bool wasInWorker = t_inWorker;
+      ~InlineGuard() { t_inWorker = wasInWorker; }
+    } guard;
+    t_inWorker = true;
+    for (size_t i = 0; i < n; i++)
+      invoke(job, i);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_job = job;
+    m_invoke = invoke;
+    m_jobSize = n;
+    m_next = 0;
+    m_active = m_workers.size();
+    m_error = nullptr;
+    m_generation++;
+  }
+  m_wake.notify_all();
+
+  // Runs however this frame is left: the workers may still be running the
+  // job, which dies with it, so stop handing out indices and wait for them.
+  struct JobGuard {
+    ThreadPool &pool;
+    size_t n;
+    ~JobGuard() {
+      t_inWorker = false;
+      pool.m_next = n;
+      std::unique_lock<std::mutex> lock(pool.m_mutex);
+      pool.m_done.wait(lock, [&] { return pool.m_active == 0; });
+      pool.m_job = nullptr;
+    }
+  };
+
+  std::exception_ptr error;
+  {
+    JobGuard guard{*this, n};
+    t_inWorker = true;
+    size_t i;
+    while ((i = m_next.fetch_add(1)) < n) {
+      invoke(job, i);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    error = std::exchange(m_error, nullptr);
+  }
+  if (error)
+    std::rethrow_exception(error);
+}
+
+bool ThreadPool::in_worker() { return t_inWorker; }
+
+ThreadPool &thread_pool() {
+  std::call_once(s_poolOnce, [] {
+    std::lock_guard<std::mutex> lock(s_poolMutex);
+    if (!s_pool) {
+      s_pool = std::make_unique<ThreadPool>(default_num_threads());
+      s_current = s_pool.get();
+    }
+  });
+  return *s_current.load(std::memory_order_acquire);
+}
+
+void set_num_threads(size_t numThreads) {
+  std::lock_guard<std::mutex> lock(s_poolMutex);
+  std::unique_ptr<ThreadPool> pool =
+      std::make_unique<ThreadPool>(numThreads > 0 ? numThreads : 1);
+  s_current = pool.get();
+  s_pool = std::move(pool);
+}
+
+size_t num_threads() { return thread_pool().num_threads(); }
+} // namespace Dendrite
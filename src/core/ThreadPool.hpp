@@ -0,0 +1,72 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Dendrite {
+// Fixed set of worker threads that run one parallel_for at a time. The
+// calling thread works on the job too, so a pool of n threads starts n - 1
+// workers.
+class ThreadPool {
+private:
+  std::vector<std::thread> m_workers;
+
+  std::mutex m_submitMutex; // one job at a time
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_done;
+
+  // The running job, called as m_invoke(m_job, i). Type-erased by hand so
+  // submitting a job never allocates, whatever the callable captures.
+  const void *m_job = nullptr;
+  void (*m_invoke)(const void *job, size_t i) = nullptr;
+  size_t m_jobSize = 0;
+  std::atomic<size_t> m_next{0};
+  size_t m_active = 0;
+  std::exception_ptr m_error; // first exception a worker's fn threw
+  uint64_t m_generation = 0;
+  bool m_stop = false;
+
+  void worker_loop();
+  void run(size_t n, const void *job, void (*invoke)(const void *, size_t));
+
+public:
+  explicit ThreadPool(size_t numThreads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t num_threads() const { return m_workers.size() + 1; }
+
+  // Calls fn(i) for every i in [0, n) and returns once all calls finished.
+  // Runs serially when called from inside a pool task, or while another
+  // thread's job is running, so nested parallel code never deadlocks. If fn
+  // throws, the remaining indices may be skipped, and the first exception
+  // is rethrown here once every thread has left fn.
+  template <typename F> void parallel_for(size_t n, const F &fn) {
+    run(n, &fn, [](const void *job, size_t i) {
+      (*static_cast<const F *>(job))(i);
+    });
+  }
+
+  // True on a thread currently executing pool tasks
+  static bool in_worker();
+};
+
+// Process wide pool used by the parallel kernels. The size defaults to
+// DENDRITE_NUM_THREADS, or the hardware concurrency. Set it before starting
+// parallel work: set_num_threads replaces the pool.
+ThreadPool &thread_pool();
+void set_num_threads(size_t numThreads);
+size_t num_threads();
+} // namespace Dendrite
+
+#endif // !THREAD_POOL_H
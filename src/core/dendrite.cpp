@@ -5,6 +5,9 @@
 #include "math/ReLU.hpp"
 #include "math/Sigmoid.hpp"
 #include "math/Softmax.hpp"
+#include "nn/Adam.hpp"
+#include "nn/Optimizer.hpp"
+#include "nn/Sgd.hpp"
 
 namespace Dendrite {
 void init_functions() {
@@ -16,5 +19,12 @@ void init_functions() {
   ActivationFunction::register_func("relu", (ActivationFunction *)(new ReLU()));
   ActivationFunction::register_func("softmax",
                                     (ActivationFunction *)(new Softmax()));
+
+  Optimizer::register_func("sgd", (Optimizer *)(new Sgd()));
+  Optimizer::register_func("momentum", (Optimizer *)(new Sgd(0.9f)));
+  Optimizer::register_func("nesterov", (Optimizer *)(new Sgd(0.9f, true)));
+  Optimizer::register_func("adam", (Optimizer *)(new Adam()));
+  Optimizer::register_func(
+      "adamw", (Optimizer *)(new Adam(0.9f, 0.999f, 1e-8f, 0.01f, true)));
 }
 } // namespace Dendrite
@@ -1,29 +1,12 @@
 #include "core/dendrite.hpp"
 #include "math/Matrix.hpp"
+#include "nn/Evaluator.hpp"
 #include "nn/NeuralNetwork.hpp"
+#include "nn/QuantizedNetwork.hpp"
 #include "testing/Mnist.hpp"
+#include <chrono>
 #include <filesystem>
-
-bool check_one_hot(const Dendrite::Matrix &pred,
-                   const Dendrite::Matrix &truth) {
-  size_t predIdx = -1;
-  float predMax = 0;
-  size_t truthIdx = -1;
-
-  for (size_t i = 0; i < truth.rows(); i++)
-    if (truth.get(i, 0) == 1.0f)
-      truthIdx = i;
-
-  for (size_t i = 0; i < pred.rows(); i++) {
-    float x = pred.get(i, 0);
-    if (x > predMax) {
-      predMax = x;
-      predIdx = i;
-    }
-  }
-
-  return predIdx == truthIdx;
-}
+#include <iomanip>
 
 int main() {
   Dendrite::init_functions();
@@ -41,25 +24,67 @@ int main() {
   net.set_output_layer(10, ("sigmoid"));
   net.init();
 
+  // to prune the hidden layers to 90% over epochs 20 to 120, then fine-tune:
+  // const size_t stepsPerEpoch = (trainImages.cols() + 63) / 64;
+  // net.set_pruning_schedule(
+  //     {0.9f, 20 * stepsPerEpoch, 120 * stepsPerEpoch, stepsPerEpoch});
+
+  std::cout << "TRAINING WORKSPACE: " << net.plan_training(64) / 1024
+            << " KiB\n";
   net.train(trainImages, trainLabels, 64, 200, 0.1);
   net.save("res/models/test.dm");
+  // pruned layers run through the sparse kernels from here on
+  net.freeze();
 
   // net.load("res/models/test.dm");
   const Dendrite::Matrix testImages = mnist.get_test_images().value();
   const Dendrite::Matrix testLabels = mnist.get_test_labels().value();
 
-  size_t correct = 0;
+  Dendrite::Evaluator evaluator(net, 3);
+  auto start = std::chrono::steady_clock::now();
+  const Dendrite::EvalResult res = evaluator.evaluate(testImages, testLabels);
+  const double fp32Ms = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
 
-  for (size_t i = 0; i < testImages.cols(); i++) {
-    // std::cout << "correct\n";
-    Dendrite::Matrix out = net.forward(testImages.get_col(i));
-    Dendrite::Matrix truth = testLabels.get_col(i);
+  std::cout << "ACCURACY ON TEST DATA: " << res.accuracy() << "\n";
+  std::cout << "TOP-" << res.topK << " ACCURACY: " << res.top_k_accuracy()
+            << "\n";
+  std::cout << "MEAN LOSS: " << res.mean_loss() << "\n";
+  for (size_t i = 0; i + 2 < net.num_layers(); i++) // hidden layers
+    std::cout << "LAYER " << i << " SPARSITY: " << net.layer(i).sparsity()
+              << "\n";
 
-    if (check_one_hot(out, truth)) {
-      correct++;
-    }
+  // rows are the true digit, columns the predicted one
+  std::cout << "CONFUSION MATRIX:\n";
+  for (size_t t = 0; t < res.classes; t++) {
+    for (size_t p = 0; p < res.classes; p++)
+      std::cout << std::setw(6) << res.confusion_at(t, p);
+    std::cout << "\n";
   }
 
-  std::cout << "ACCURACY ON TEST DATA: " << ((float)correct / testLabels.cols())
-            << "\n";
+  // int8 copy for serving, calibrated on a slice of the training set
+  const Dendrite::QuantizedNetwork qnet = Dendrite::QuantizedNetwork::quantize(
+      net, trainImages.block(0, 0, trainImages.rows(), 1000));
+  qnet.save("res/models/test.qdm");
+
+  Dendrite::Evaluator qevaluator(qnet, 3);
+  start = std::chrono::steady_clock::now();
+  const Dendrite::EvalResult qres =
+      qevaluator.evaluate(testImages, testLabels);
+  const double int8Ms = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+
+  std::cout << "INT8 ACCURACY ON TEST DATA: " << qres.accuracy()
+            << " (DELTA " << qres.accuracy() - res.accuracy() << ")\n";
+  std::cout << "INT8 MEAN LOSS: " << qres.mean_loss() << " (DELTA "
+            << qres.mean_loss() - res.mean_loss() << ")\n";
+  std::cout << "TEST SET TIME: " << fp32Ms << " MS FP32, " << int8Ms
+            << " MS INT8\n";
+  std::cout << "MODEL SIZE: "
+            << std::filesystem::file_size("res/models/test.dm")
+            << " BYTES FP32, "
+            << std::filesystem::file_size("res/models/test.qdm")
+            << " BYTES INT8\n";
 }
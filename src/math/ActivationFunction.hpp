@@ -2,6 +2,7 @@
 #define ACTIVATION_H
 
 #include "math/Matrix.hpp"
+#include <cassert>
 #include <map>
 #include <string>
 
@@ -13,6 +14,22 @@ public:
   virtual Matrix deriv(const Matrix &input) const = 0;
   virtual Matrix &deriv_inplace(Matrix &input) const = 0;
 
+  // Activation of n contiguous values, out may alias in. Fused kernels call
+  // this tile by tile, so only elementwise functions override them (and
+  // elementwise()); the defaults are never called.
+  virtual void activate_span(const float *, float *, size_t) const {
+    assert(false && "activate_span on a non-elementwise activation");
+  }
+  virtual void deriv_span(const float *, float *, size_t) const {
+    assert(false && "deriv_span on a non-elementwise activation");
+  }
+
+  // True when each output depends on its own input alone, so the
+  // activation can be fused into kernels through activate_span(). Off by
+  // default, so functions that only implement activate() and deriv() keep
+  // going through those.
+  virtual bool elementwise() const { return false; }
+
   inline static std::map<std::string, ActivationFunction *>
       s_activationFunctions;
 
@@ -22,7 +39,7 @@ public:
   }
 
   static ActivationFunction &get_from_name(const std::string &name) {
-    return *s_activationFunctions[name];
+    return *s_activationFunctions.at(name);
   }
 };
 } // namespace Dendrite
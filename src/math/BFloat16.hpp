@@ -0,0 +1,35 @@
+#ifndef BFLOAT16_H
+#define BFLOAT16_H
+
+#include <cstdint>
+#include <cstring>
+
+namespace Dendrite {
+// The upper half of an IEEE float: the same exponent range with 8 bits of
+// mantissa. Storage only, arithmetic widens to float first.
+struct BFloat16 {
+  uint16_t bits;
+};
+
+// Round to nearest even. NaNs stay NaNs (quieted) rather than rounding up
+// into infinity.
+inline BFloat16 to_bf16(float x) {
+  uint32_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+  if ((bits & 0x7fffffffu) > 0x7f800000u)
+    return BFloat16{(uint16_t)((bits >> 16) | 0x40)};
+  bits += 0x7fffu + ((bits >> 16) & 1);
+  return BFloat16{(uint16_t)(bits >> 16)};
+}
+
+inline float to_float(BFloat16 x) {
+  const uint32_t bits = (uint32_t)x.bits << 16;
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+inline float to_float(float x) { return x; }
+} // namespace Dendrite
+
+#endif // !BFLOAT16_H
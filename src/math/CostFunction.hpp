@@ -8,13 +8,19 @@
 namespace Dendrite {
 class CostFunction {
 public:
-  virtual Matrix cost(const Matrix &x, const Matrix &truth) const = 0;
-  virtual Matrix deriv(const Matrix &x, const Matrix &truth) const = 0;
+  virtual Matrix cost(const MatrixView &x, const MatrixView &truth) const = 0;
+  virtual Matrix deriv(const MatrixView &x, const MatrixView &truth) const = 0;
+
+  // deriv() into an existing matrix, reusing its buffer
+  virtual void deriv_into(const MatrixView &x, const MatrixView &truth,
+                          Matrix &out) const {
+    out = deriv(x, truth);
+  }
 
   inline static std::map<std::string, CostFunction *> s_costFunctions;
 
   static CostFunction &get_from_name(const std::string &name) {
-    return *s_costFunctions[name];
+    return *s_costFunctions.at(name);
   }
 
   static void register_func(const std::string &name, CostFunction *cost) {
@@ -0,0 +1,428 @@
+#include "Gemm.hpp"
+#include "core/Pool.hpp"
+#include "core/ThreadPool.hpp"
+#include "math/ActivationFunction.hpp"
+#include "math/simd/Kernels.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+
+namespace Dendrite {
+namespace {
+std::atomic<size_t> s_parallelThreshold{64 * 64 * 64};
+// Copies an mc x kc block of A into mr-row panels, zero padding the last one.
+// bf16 is widened on the way in.
+template <typename T>
+void pack_a(size_t mc, size_t kc, const T *a, size_t rsa, size_t csa,
+            size_t mr, float *out) {
+  for (size_t ir = 0; ir < mc; ir += mr) {
+    const size_t rows = std::min(mr, mc - ir);
+    for (size_t p = 0; p < kc; p++) {
+      for (size_t i = 0; i < rows; i++) {
+        out[p * mr + i] = to_float(a[(ir + i) * rsa + p * csa]);
+      }
+      for (size_t i = rows; i < mr; i++) {
+        out[p * mr + i] = 0.0f;
+      }
+    }
+    out += mr * kc;
+  }
+}
+
+void copy_row(const float *row, size_t cols, float *out) {
+  std::copy(row, row + cols, out);
+}
+
+void copy_row(const BFloat16 *row, size_t cols, float *out) {
+  kernels().from_bf16(row, out, cols);
+}
+
+// Copies a kc x nc block of B into nr-col panels, zero padding the last one.
+template <typename T>
+void pack_b(size_t kc, size_t nc, const T *b, size_t rsb, size_t csb,
+            size_t nr, float *out) {
+  for (size_t jr = 0; jr < nc; jr += nr) {
+    const size_t cols = std::min(nr, nc - jr);
+    for (size_t p = 0; p < kc; p++) {
+      const T *row = b + p * rsb + jr * csb;
+      if (csb == 1) {
+        copy_row(row, cols, out + p * nr);
+      } else {
+        for (size_t j = 0; j < cols; j++) {
+          out[p * nr + j] = to_float(row[j * csb]);
+        }
+      }
+      for (size_t j = cols; j < nr; j++) {
+        out[p * nr + j] = 0.0f;
+      }
+    }
+    out += nr * kc;
+  }
+}
+
+void scale_c(size_t m, size_t n, float beta, float *c, size_t rsc,
+             size_t csc) {
+  for (size_t i = 0; i < m; i++) {
+    for (size_t j = 0; j < n; j++) {
+      float &cij = c[i * rsc + j * csc];
+      cij = beta == 0.0f ? 0.0f : beta * cij;
+    }
+  }
+}
+
+// Adds the row bias to an mr x cols tile of C and writes the activation of
+// it to out, while the tile is still in L1.
+void apply_epilogue(const GemmEpilogue &ep, size_t row, size_t col,
+                    size_t rows, size_t cols, float *c, size_t rsc) {
+  constexpr size_t CHUNK = 64;
+  float *z = c + row * rsc + col;
+
+  for (size_t i = 0; i < rows; i++) {
+    if (ep.bias != nullptr) {
+      kernels().add_scalar(z + i * rsc, ep.bias[row + i], z + i * rsc, cols);
+    }
+    if (ep.outBf16 == nullptr) {
+      ep.fn->activate_span(z + i * rsc, ep.out + (row + i) * ep.rso + col,
+                           cols);
+      continue;
+    }
+    // activate into L1 scratch, then narrow
+    BFloat16 *out = ep.outBf16 + (row + i) * ep.rso + col;
+    float act[CHUNK];
+    for (size_t j = 0; j < cols; j += CHUNK) {
+      const size_t len = std::min(CHUNK, cols - j);
+      ep.fn->activate_span(z + i * rsc + j, act, len);
+      kernels().to_bf16(act, out + j, len);
+    }
+  }
+}
+
+// Matrix-vector product for row-contiguous A (csa == 1). Packing would read
+// A twice for no reuse, so go straight through it.
+void gemv_rows(size_t m, size_t k, float alpha, const float *a, size_t rsa,
+               const float *x, float beta, float *y, size_t incy) {
+  constexpr size_t LANES = 8;
+
+  for (size_t i = 0; i < m; i++) {
+    const float *row = a + i * rsa;
+    float partial[LANES] = {};
+    size_t p = 0;
+    for (; p + LANES <= k; p += LANES) {
+      for (size_t l = 0; l < LANES; l++) {
+        partial[l] += row[p + l] * x[p + l];
+      }
+    }
+    float sum = 0.0f;
+    for (size_t l = 0; l < LANES; l++) {
+      sum += partial[l];
+    }
+    for (; p < k; p++) {
+      sum += row[p] * x[p];
+    }
+
+    float &yi = y[i * incy];
+    yi = beta == 0.0f ? alpha * sum : alpha * sum + beta * yi;
+  }
+}
+
+// Matrix-vector product for column-contiguous A (rsa == 1), e.g. a
+// transposed row-major matrix: y accumulates one scaled column of A per x.
+void gemv_cols(size_t m, size_t k, float alpha, const float *a, size_t csa,
+               const float *x, float beta, float *y) {
+  if (beta == 0.0f) {
+    std::fill(y, y + m, 0.0f);
+  } else if (beta != 1.0f) {
+    kernels().scale(y, beta, y, m);
+  }
+  for (size_t p = 0; p < k; p++) {
+    kernels().axpy(alpha * x[p], a + p * csa, y, m);
+  }
+}
+
+void gemv(size_t m, size_t k, float alpha, const float *a, size_t rsa,
+          size_t csa, const float *x, size_t incx, float beta, float *y,
+          size_t incy, const GemmEpilogue *ep) {
+  if (incx != 1) {
+    thread_local PoolVector<float> packedX;
+    packedX.resize(k);
+    for (size_t p = 0; p < k; p++) {
+      packedX[p] = x[p * incx];
+    }
+    x = packedX.data();
+  }
+
+  // finish the output in chunks so the epilogue reads z back from L1
+  constexpr size_t CHUNK = 64;
+  for (size_t i = 0; i < m; i += CHUNK) {
+    const size_t rows = std::min(CHUNK, m - i);
+    if (csa == 1) {
+      gemv_rows(rows, k, alpha, a + i * rsa, rsa, x, beta, y + i * incy,
+                incy);
+    } else {
+      float chunk[CHUNK];
+      float *yi = incy == 1 ? y + i : chunk;
+      if (incy != 1 && beta != 0.0f) {
+        for (size_t r = 0; r < rows; r++)
+          chunk[r] = y[(i + r) * incy];
+      }
+      gemv_cols(rows, k, alpha, a + i, csa, x, beta, yi);
+      if (incy != 1) {
+        for (size_t r = 0; r < rows; r++)
+          y[(i + r) * incy] = chunk[r];
+      }
+    }
+
+    if (ep == nullptr) {
+      continue;
+    }
+    if (incy == 1 && ep->rso == 1 && ep->outBf16 == nullptr) {
+      // contiguous column: treat the chunk as one span
+      if (ep->bias != nullptr) {
+        kernels().add(y + i, ep->bias + i, y + i, rows);
+      }
+      ep->fn->activate_span(y + i, ep->out + i, rows);
+    } else {
+      apply_epilogue(*ep, i, 0, rows, 1, y, incy);
+    }
+  }
+}
+
+// C = alpha * a * b^T + beta * C for column a and row b (k == 1), one axpy
+// per row of a row-contiguous C.
+void rank1_update(size_t m, size_t n, float alpha, const float *a, size_t rsa,
+                  const float *b, size_t csb, float beta, float *c,
+                  size_t rsc) {
+  if (csb != 1) {
+    thread_local PoolVector<float> packedB;
+    packedB.resize(n);
+    for (size_t j = 0; j < n; j++) {
+      packedB[j] = b[j * csb];
+    }
+    b = packedB.data();
+  }
+
+  for (size_t i = 0; i < m; i++) {
+    float *row = c + i * rsc;
+    if (beta == 0.0f) {
+      std::fill(row, row + n, 0.0f);
+    } else if (beta != 1.0f) {
+      kernels().scale(row, beta, row, n);
+    }
+    kernels().axpy(alpha * a[i * rsa], b, row, n);
+  }
+}
+
+template <typename TA, typename TB>
+void gemm_driver(size_t m, size_t n, size_t k, float alpha, const TA *a,
+                 size_t rsa, size_t csa, const TB *b, size_t rsb, size_t csb,
+                 float beta, float *c, size_t rsc, size_t csc,
+                 const GemmEpilogue *ep);
+
+// Splits C into a grid of roughly square blocks, one per thread, each a
+// whole number of register tiles, and runs the serial driver on each block.
+template <typename TA, typename TB>
+void gemm_parallel(ThreadPool &pool, size_t m, size_t n, size_t k,
+                   float alpha, const TA *a, size_t rsa, size_t csa,
+                   const TB *b, size_t rsb, size_t csb, float beta, float *c,
+                   size_t rsc, size_t csc, const GemmEpilogue *ep) {
+  const GemmKernel &kern = gemm_kernel();
+  const size_t threads = pool.num_threads();
+  const size_t rowTiles = (m + kern.mr - 1) / kern.mr;
+  const size_t colTiles = (n + kern.nr - 1) / kern.nr;
+
+  size_t gridRows = (size_t)std::lround(std::sqrt((double)threads * m / n));
+  gridRows = std::max<size_t>(1, std::min(gridRows, rowTiles));
+  size_t gridCols = (threads + gridRows - 1) / gridRows;
+  gridCols = std::max<size_t>(1, std::min(gridCols, colTiles));
+
+  const size_t blockRows = (rowTiles + gridRows - 1) / gridRows * kern.mr;
+  const size_t blockCols = (colTiles + gridCols - 1) / gridCols * kern.nr;
+  gridRows = (m + blockRows - 1) / blockRows;
+  gridCols = (n + blockCols - 1) / blockCols;
+
+  pool.parallel_for(gridRows * gridCols, [&](size_t t) {
+    const size_t i0 = (t / gridCols) * blockRows;
+    const size_t j0 = (t % gridCols) * blockCols;
+    const size_t rows = std::min(blockRows, m - i0);
+    const size_t cols = std::min(blockCols, n - j0);
+
+    GemmEpilogue sub;
+    if (ep != nullptr) {
+      sub = *ep;
+      sub.bias = ep->bias != nullptr ? ep->bias + i0 : nullptr;
+      if (ep->outBf16 != nullptr)
+        sub.outBf16 = ep->outBf16 + i0 * ep->rso + j0;
+      else
+        sub.out = ep->out + i0 * ep->rso + j0;
+    }
+
+    gemm_driver(rows, cols, k, alpha, a + i0 * rsa, rsa, csa, b + j0 * csb,
+                rsb, csb, beta, c + i0 * rsc + j0 * csc, rsc, csc,
+                ep != nullptr ? &sub : nullptr);
+  });
+}
+
+template <typename TA, typename TB>
+void gemm_driver(size_t m, size_t n, size_t k, float alpha, const TA *a,
+                 size_t rsa, size_t csa, const TB *b, size_t rsb, size_t csb,
+                 float beta, float *c, size_t rsc, size_t csc,
+                 const GemmEpilogue *ep) {
+  if (m == 0 || n == 0) {
+    return;
+  }
+
+  if (m * n * k >= s_parallelThreshold.load(std::memory_order_relaxed) &&
+      !ThreadPool::in_worker()) {
+    ThreadPool &pool = thread_pool();
+    if (pool.num_threads() > 1) {
+      gemm_parallel(pool, m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c,
+                    rsc, csc, ep);
+      return;
+    }
+  }
+  if (k == 0 || alpha == 0.0f) {
+    scale_c(m, n, beta, c, rsc, csc);
+    if (ep != nullptr) {
+      apply_epilogue(*ep, 0, 0, m, n, c, rsc);
+    }
+    return;
+  }
+
+  // bf16 operands always take the packed path, which widens them
+  if constexpr (std::is_same_v<TA, float> && std::is_same_v<TB, float>) {
+    if (n == 1 && (csa == 1 || rsa == 1)) {
+      gemv(m, k, alpha, a, rsa, csa, b, rsb, beta, c, rsc, ep);
+      return;
+    }
+    if (k == 1 && csc == 1 && ep == nullptr) {
+      rank1_update(m, n, alpha, a, rsa, b, csb, beta, c, rsc);
+      return;
+    }
+  }
+
+  const GemmKernel &kern = gemm_kernel();
+  const size_t mr = kern.mr;
+  const size_t nr = kern.nr;
+
+  thread_local PoolVector<float> packedA;
+  thread_local PoolVector<float> packedB;
+  const size_t mcMax = std::min(kern.mc, (m + mr - 1) / mr * mr);
+  const size_t ncMax = std::min(kern.nc, (n + nr - 1) / nr * nr);
+  const size_t kcMax = std::min(kern.kc, k);
+  if (packedA.size() < mcMax * kcMax)
+    packedA.resize(mcMax * kcMax);
+  if (packedB.size() < kcMax * ncMax)
+    packedB.resize(kcMax * ncMax);
+
+  float edge[64 * 64];
+
+  for (size_t jc = 0; jc < n; jc += kern.nc) {
+    const size_t nc = std::min(kern.nc, n - jc);
+
+    for (size_t pc = 0; pc < k; pc += kern.kc) {
+      const size_t kc = std::min(kern.kc, k - pc);
+      const float betaBlock = pc == 0 ? beta : 1.0f;
+      const bool lastBlock = pc + kc == k;
+
+      pack_b(kc, nc, b + pc * rsb + jc * csb, rsb, csb, nr, packedB.data());
+
+      for (size_t ic = 0; ic < m; ic += kern.mc) {
+        const size_t mc = std::min(kern.mc, m - ic);
+
+        pack_a(mc, kc, a + ic * rsa + pc * csa, rsa, csa, mr, packedA.data());
+
+        for (size_t jr = 0; jr < nc; jr += nr) {
+          const size_t cols = std::min(nr, nc - jr);
+          const float *bp = packedB.data() + jr * kc;
+
+          for (size_t ir = 0; ir < mc; ir += mr) {
+            const size_t rows = std::min(mr, mc - ir);
+            const float *ap = packedA.data() + ir * kc;
+            float *cp = c + (ic + ir) * rsc + (jc + jr) * csc;
+
+            if (rows == mr && cols == nr) {
+              kern.kernel(kc, ap, bp, cp, rsc, csc, alpha, betaBlock);
+            } else {
+              // partial tile: compute into a scratch tile and merge
+              kern.kernel(kc, ap, bp, edge, nr, 1, alpha, 0.0f);
+              for (size_t i = 0; i < rows; i++) {
+                for (size_t j = 0; j < cols; j++) {
+                  float &cij = cp[i * rsc + j * csc];
+                  cij = betaBlock == 0.0f
+                            ? edge[i * nr + j]
+                            : edge[i * nr + j] + betaBlock * cij;
+                }
+              }
+            }
+
+            if (ep != nullptr && lastBlock) {
+              apply_epilogue(*ep, ic + ir, jc + jr, rows, cols, c, rsc);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+} // namespace
+
+const GemmKernel &gemm_kernel() { return kernels().gemm; }
+
+void set_gemm_parallel_threshold(size_t mnk) { s_parallelThreshold = mnk; }
+
+size_t gemm_parallel_threshold() { return s_parallelThreshold; }
+
+void gemm(size_t m, size_t n, size_t k, float alpha, const float *a,
+          size_t rsa, size_t csa, const float *b, size_t rsb, size_t csb,
+          float beta, float *c, size_t rsc, size_t csc) {
+  gemm_driver(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc, csc,
+              (const GemmEpilogue *)nullptr);
+}
+
+void gemm_bias_act(size_t m, size_t n, size_t k, const float *a, size_t rsa,
+                   size_t csa, const float *b, size_t rsb, size_t csb,
+                   float *c, size_t rsc, const GemmEpilogue &ep) {
+  assert(ep.fn != nullptr && ep.fn->elementwise());
+  gemm_driver(m, n, k, 1.0f, a, rsa, csa, b, rsb, csb, 0.0f, c, rsc, 1, &ep);
+}
+
+void gemm_mixed(size_t m, size_t n, size_t k, float alpha,
+                const GemmOperand &a, const GemmOperand &b, float beta,
+                float *c, size_t rsc, size_t csc, const GemmEpilogue *ep) {
+  assert((a.f32 == nullptr) != (a.bf16 == nullptr));
+  assert((b.f32 == nullptr) != (b.bf16 == nullptr));
+  assert(ep == nullptr || (beta == 0.0f && csc == 1 && ep->fn != nullptr &&
+                           ep->fn->elementwise()));
+
+  if (a.f32 != nullptr && b.f32 != nullptr)
+    gemm_driver(m, n, k, alpha, a.f32, a.rs, a.cs, b.f32, b.rs, b.cs, beta, c,
+                rsc, csc, ep);
+  else if (a.f32 != nullptr)
+    gemm_driver(m, n, k, alpha, a.f32, a.rs, a.cs, b.bf16, b.rs, b.cs, beta,
+                c, rsc, csc, ep);
+  else if (b.f32 != nullptr)
+    gemm_driver(m, n, k, alpha, a.bf16, a.rs, a.cs, b.f32, b.rs, b.cs, beta,
+                c, rsc, csc, ep);
+  else
+    gemm_driver(m, n, k, alpha, a.bf16, a.rs, a.cs, b.bf16, b.rs, b.cs, beta,
+                c, rsc, csc, ep);
+}
+
+void gemm_naive(size_t m, size_t n, size_t k, float alpha, const float *a,
+                size_t rsa, size_t csa, const float *b, size_t rsb, size_t csb,
+                float beta, float *c, size_t rsc, size_t csc) {
+  for (size_t i = 0; i < m; i++) {
+    for (size_t j = 0; j < n; j++) {
+      float sum = 0;
+      for (size_t p = 0; p < k; p++) {
+        sum += a[i * rsa + p * csa] * b[p * rsb + j * csb];
+      }
+      float &cij = c[i * rsc + j * csc];
+      cij = beta == 0.0f ? alpha * sum : alpha * sum + beta * cij;
+    }
+  }
+}
+} // namespace Dendrite
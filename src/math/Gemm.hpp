@@ -0,0 +1,85 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include "math/BFloat16.hpp"
+#include <cstddef>
+
+namespace Dendrite {
+class ActivationFunction;
+
+// Register tile computed by a micro-kernel:
+// C[mr x nr] = alpha * (packed A panel) * (packed B panel) + beta * C
+// A panel is kc x mr (column of mr values per k), B panel is kc x nr.
+// When beta == 0, C is never read.
+typedef void (*GemmMicroKernel)(size_t kc, const float *a, const float *b,
+                                float *c, size_t rsc, size_t csc, float alpha,
+                                float beta);
+
+struct GemmKernel {
+  const char *name;
+  GemmMicroKernel kernel;
+  size_t mr; // register tile rows
+  size_t nr; // register tile cols
+  size_t mc; // rows of A packed per L2 block (multiple of mr)
+  size_t kc; // depth of a packed panel, sized so a B micro-panel stays in L1
+  size_t nc; // cols of B packed per L3 block (multiple of nr)
+};
+
+const GemmKernel &gemm_kernel();
+
+// Products with m * n * k at or above this split C into 2D blocks across
+// thread_pool() (see core/ThreadPool.hpp for the thread count). Smaller
+// ones, and any GEMM issued from inside a pool task, stay on one thread.
+void set_gemm_parallel_threshold(size_t mnk);
+size_t gemm_parallel_threshold();
+
+// C[m x n] = alpha * A[m x k] * B[k x n] + beta * C
+// Every operand is addressed through a row stride (rs) and column stride (cs),
+// so row-major, column-major and transposed operands need no copies.
+void gemm(size_t m, size_t n, size_t k, float alpha, const float *a,
+          size_t rsa, size_t csa, const float *b, size_t rsb, size_t csb,
+          float beta, float *c, size_t rsc, size_t csc);
+
+// Work folded into the GEMM once a tile of C is final: add bias (one value
+// per row of C, may be null), then write fn(C) to out (row stride rso), or
+// rounded to bf16 to outBf16 instead when that is set.
+struct GemmEpilogue {
+  const float *bias;
+  const ActivationFunction *fn;
+  float *out;
+  size_t rso;
+  BFloat16 *outBf16;
+};
+
+// C = A * B + bias, out = fn(C), in one sweep over each output tile.
+// C and out must be row-contiguous and fn elementwise.
+void gemm_bias_act(size_t m, size_t n, size_t k, const float *a, size_t rsa,
+                   size_t csa, const float *b, size_t rsb, size_t csb,
+                   float *c, size_t rsc, const GemmEpilogue &ep);
+
+// An operand stored as either fp32 (f32) or bf16 (bf16), the other null,
+// with strides as above
+struct GemmOperand {
+  const float *f32;
+  const BFloat16 *bf16;
+  size_t rs;
+  size_t cs;
+};
+
+// C = alpha * A * B + beta * C for operands of either precision. bf16
+// blocks are widened to fp32 as they're packed, so the same micro-kernels
+// accumulate in fp32 and only the operand traffic shrinks. With ep set
+// (beta must be 0 and C row-contiguous) the epilogue runs as in
+// gemm_bias_act().
+void gemm_mixed(size_t m, size_t n, size_t k, float alpha,
+                const GemmOperand &a, const GemmOperand &b, float beta,
+                float *c, size_t rsc, size_t csc,
+                const GemmEpilogue *ep = nullptr);
+
+// Reference triple loop, used to check the blocked kernel.
+void gemm_naive(size_t m, size_t n, size_t k, float alpha, const float *a,
+                size_t rsa, size_t csa, const float *b, size_t rsb, size_t csb,
+                float beta, float *c, size_t rsc, size_t csc);
+} // namespace Dendrite
+
+#endif // !GEMM_H
@@ -1,164 +1,155 @@
 #include "Matrix.hpp"
+#include "math/Gemm.hpp"
+#include "math/simd/Kernels.hpp"
+#include <algorithm>
 #include <functional>
 #include <iostream>
 namespace Dendrite {
+namespace {
+// Flat kernels need row-major elements. Contiguous views are used as is,
+// strided ones are gathered into a per-thread scratch buffer.
+const float *contiguous(const MatrixView &view) {
+  if (view.contiguous()) {
+    return view.data();
+  }
 
-float Matrix::get(size_t i, size_t j) const {
-  assert(i >= 0 && i < m_rows && j >= 0 && j < m_cols);
-  return m_elements[i * m_cols + j];
-}
-
-Matrix Matrix::get_row(size_t i) const {
-  Matrix row = Matrix(1, m_cols);
-
-  for (size_t j = 0; j < m_cols; j++) {
-    row.set(0, j, get(i, j));
+  thread_local PoolVector<float> scratch;
+  scratch.resize(view.size());
+  for (size_t i = 0; i < view.rows(); i++) {
+    for (size_t j = 0; j < view.cols(); j++) {
+      scratch[i * view.cols() + j] = view.get(i, j);
+    }
   }
+  return scratch.data();
+}
+} // namespace
 
-  return row;
+float Matrix::get(size_t i, size_t j) const {
+  assert(i >= 0 && i < m_rows && j >= 0 && j < m_cols);
+  return data()[i * m_cols + j];
 }
 
-Matrix Matrix::get_col(size_t j) const {
-  Matrix col = Matrix(m_rows, 1);
-  for (size_t i = 0; i < m_rows; i++) {
-    col.set(i, 0, get(i, j));
-  }
+Matrix Matrix::get_row(size_t i) const { return Matrix(row(i)); }
 
-  return col;
-}
+Matrix Matrix::get_col(size_t j) const { return Matrix(col(j)); }
 
 void Matrix::set(size_t i, size_t j, float val) {
   assert(i >= 0 && i < m_rows && j >= 0 && j < m_cols);
-  m_elements[i * m_cols + j] = val;
+  data()[i * m_cols + j] = val;
 }
 
 void Matrix::set_data(std::vector<float> data) {
   assert(m_rows * m_cols == data.size());
-  m_elements = data;
+  std::copy(data.begin(), data.end(), this->data());
 }
 
 void Matrix::set_data(size_t i, float f) {
-  assert(i >= 0 && i < m_elements.size());
-  m_elements[i] = f;
+  assert(i >= 0 && i < size());
+  data()[i] = f;
 }
 
-void Matrix::set_data_from(const Matrix &mat) {
+void Matrix::resize(size_t rows, size_t cols) {
+  if (borrowed()) {
+    assert(rows * cols == size());
+    m_rows = rows;
+    m_cols = cols;
+    return;
+  }
+  m_rows = rows;
+  m_cols = cols;
+  m_elements.resize(rows * cols);
+}
+
+void Matrix::fill(float val) {
+  std::fill(data(), data() + size(), val);
+}
+
+void Matrix::set_data_from(const MatrixView &mat) {
   assert(same_shape(mat));
-  set_data(mat.get_data());
+  if (mat.aliases(data(), data() + size())) {
+    const Matrix copy(mat);
+    assign_expr(copy.view());
+    return;
+  }
+  assign_expr(mat);
 }
 
 Matrix &Matrix::scale_inplace(float s) {
-  for (size_t i = 0; i < m_rows; i++) {
-    for (size_t j = 0; j < m_cols; j++) {
-      set(i, j, get(i, j) * s);
-    }
-  }
+  kernels().scale(data(), s, data(), size());
   return *this;
 }
 
 Matrix Matrix::scale(float s) const {
   Matrix out = Matrix(m_rows, m_cols);
-  for (size_t i = 0; i < m_rows; i++) {
-    for (size_t j = 0; j < m_cols; j++) {
-      out.set(i, j, get(i, j) * s);
-    }
-  }
+  kernels().scale(data(), s, out.data(), size());
   return out;
 }
 
-Matrix Matrix::dot_multiply(const Matrix &other) const {
+Matrix Matrix::dot_multiply(const MatrixView &other) const {
   assert(m_cols == other.rows());
 
   Matrix res = Matrix(m_rows, other.cols());
-
-  for (size_t r = 0; r < m_rows; r++) {
-    for (size_t c = 0; c < other.cols(); c++) {
-      float sum = 0;
-      for (size_t i = 0; i < other.rows(); i++) {
-        sum += other.get(i, c) * get(r, i);
-      }
-      res.set(r, c, sum);
-    }
-  }
-
+  matmul_into(res, *this, other);
   return res;
 }
 
-Matrix Matrix::elem_multiply(const Matrix &other) const {
+Matrix Matrix::elem_multiply(const MatrixView &other) const {
   assert(same_shape(other));
 
   Matrix out = Matrix(m_rows, m_cols);
-  for (size_t i = 0; i < m_rows; i++) {
-    for (size_t j = 0; j < m_cols; j++) {
-      out.set(i, j, get(i, j) * other.get(i, j));
-    }
-  }
-
+  kernels().mul(data(), contiguous(other), out.data(), size());
   return out;
 }
 
-Matrix &Matrix::elem_multiply_inplace(const Matrix &other) {
+Matrix &Matrix::elem_multiply_inplace(const MatrixView &other) {
   assert(same_shape(other));
 
-  for (size_t i = 0; i < m_rows; i++) {
-    for (size_t j = 0; j < m_cols; j++) {
-      set(i, j, get(i, j) * other.get(i, j));
-    }
-  }
-
+  kernels().mul(data(), contiguous(other), data(), size());
   return *this;
 }
 
 Matrix Matrix::add(float x) const {
   Matrix out = Matrix(m_rows, m_cols);
-  for (size_t i = 0; i < m_rows; i++) {
-    for (size_t j = 0; j < m_cols; j++) {
-      out.set(i, j, get(i, j) + x);
-    }
-  }
+  kernels().add_scalar(data(), x, out.data(), size());
   return out;
 }
 
 Matrix &Matrix::add_inplace(float x) {
-  for (size_t i = 0; i < m_rows; i++) {
-    for (size_t j = 0; j < m_cols; j++) {
-      m_elements[i * m_cols + j] += x;
-    }
-  }
-
+  kernels().add_scalar(data(), x, data(), size());
   return *this;
 }
 
-Matrix Matrix::add(const Matrix &other) const {
+Matrix Matrix::add(const MatrixView &other) const {
   assert(other.rows() == m_rows && other.cols() == m_cols);
+
   Matrix res = Matrix(m_rows, m_cols);
+  kernels().add(data(), contiguous(other), res.data(), size());
+  return res;
+}
 
-  for (size_t i = 0; i < m_rows; i++) {
-    for (size_t j = 0; j < m_cols; j++) {
-      res.set(i, j, get(i, j) + other.get(i, j));
-    }
-  }
+Matrix &Matrix::add_inplace(const MatrixView &other) {
+  assert(other.rows() == m_rows && other.cols() == m_cols);
 
-  return res;
+  kernels().add(data(), contiguous(other), data(), size());
+  return *this;
 }
 
-Matrix &Matrix::add_inplace(const Matrix &other) {
+Matrix &Matrix::sub_inplace(const MatrixView &other, float s) {
   assert(other.rows() == m_rows && other.cols() == m_cols);
-  for (size_t i = 0; i < m_rows; i++) {
-    for (size_t j = 0; j < m_cols; j++) {
-      set(i, j, get(i, j) + other.get(i, j));
-    }
-  }
+
+  kernels().axpy(-s, contiguous(other), data(), size());
   return *this;
 }
 
 Matrix Matrix::pow_elem(float p) const {
-  return apply_function([p](float x) -> float { return std::pow(x, p); });
+  Matrix out = Matrix(m_rows, m_cols);
+  kernels().pow(data(), p, out.data(), size());
+  return out;
 }
 
 Matrix &Matrix::pow_elem_inplace(float p) {
-  return apply_function_inplace(
-      [p](float x) -> float { return std::pow(x, p); });
+  kernels().pow(data(), p, data(), size());
+  return *this;
 }
 
 Matrix Matrix::transpose() const {
@@ -175,24 +166,23 @@ Matrix Matrix::transpose() const {
 
 Matrix Matrix::apply_function(std::function<float(float)> func) const {
   Matrix out = Matrix(m_rows, m_cols);
-  for (size_t i = 0; i < m_rows; i++) {
-    for (size_t j = 0; j < m_cols; j++) {
-      out.set(i, j, func(get(i, j)));
-    }
+  const float *in = data();
+  float *res = out.data();
+  for (size_t i = 0; i < size(); i++) {
+    res[i] = func(in[i]);
   }
   return out;
 }
 
 Matrix &Matrix::apply_function_inplace(std::function<float(float)> func) {
-  for (size_t i = 0; i < m_rows; i++) {
-    for (size_t j = 0; j < m_cols; j++) {
-      set(i, j, func(get(i, j)));
-    }
+  float *elems = data();
+  for (size_t i = 0; i < size(); i++) {
+    elems[i] = func(elems[i]);
   }
   return *this;
 }
 
-bool Matrix::same_shape(const Matrix &other) const {
+bool Matrix::same_shape(const MatrixView &other) const {
   return (m_cols == other.cols() && m_rows == other.rows());
 }
 
@@ -207,8 +197,89 @@ void Matrix::print() const {
   }
 }
 
+void Matrix::assign_expr(const MatrixView &view) {
+  float *out = data();
+  for (size_t i = 0; i < view.rows(); i++) {
+    const float *row = view.data() + i * view.row_stride();
+    for (size_t j = 0; j < view.cols(); j++) {
+      out[i * m_cols + j] = row[j * view.col_stride()];
+    }
+  }
+}
+
 Matrix Matrix::with_same_shape(const Matrix &other) {
   return Matrix(other.rows(), other.cols());
 }
 
+void matmul_into(Matrix &c, const MatrixView &a, const MatrixView &b,
+                 float alpha, float beta) {
+  assert(a.cols() == b.rows());
+  assert(c.rows() == a.rows() && c.cols() == b.cols());
+
+  gemm(a.rows(), b.cols(), a.cols(), alpha, a.data(), a.row_stride(),
+       a.col_stride(), b.data(), b.row_stride(), b.col_stride(), beta,
+       c.data(), c.cols(), 1);
+}
+
+void row_sums_into(Matrix &out, const MatrixView &a, float beta) {
+  assert(out.rows() == a.rows() && out.cols() == 1);
+  constexpr size_t LANES = 8;
+
+  for (size_t i = 0; i < a.rows(); i++) {
+    const float *row = a.data() + i * a.row_stride();
+    float sum = 0.0f;
+    if (a.col_stride() == 1) {
+      float partial[LANES] = {};
+      size_t j = 0;
+      for (; j + LANES <= a.cols(); j += LANES) {
+        for (size_t l = 0; l < LANES; l++)
+          partial[l] += row[j + l];
+      }
+      for (; j < a.cols(); j++)
+        sum += row[j];
+      for (size_t l = 0; l < LANES; l++)
+        sum += partial[l];
+    } else {
+      for (size_t j = 0; j < a.cols(); j++)
+        sum += row[j * a.col_stride()];
+    }
+
+    float *o = out.data() + i;
+    *o = beta == 0.0f ? sum : sum + beta * *o;
+  }
+}
+
+Matrix matmul_tn(const MatrixView &a, const MatrixView &b) {
+  Matrix c = Matrix(a.cols(), b.cols());
+  matmul_into(c, a.transpose(), b);
+  return c;
+}
+
+Matrix matmul_nt(const MatrixView &a, const MatrixView &b) {
+  Matrix c = Matrix(a.rows(), b.rows());
+  matmul_into(c, a, b.transpose());
+  return c;
+}
+
+Matrix matmul_tt(const MatrixView &a, const MatrixView &b) {
+  Matrix c = Matrix(a.cols(), b.rows());
+  matmul_into(c, a.transpose(), b.transpose());
+  return c;
+}
+
+void matmul_acc(Matrix &c, const MatrixView &a, const MatrixView &b,
+                float alpha) {
+  matmul_into(c, a, b, alpha, 1.0f);
+}
+
+void matmul_tn_acc(Matrix &c, const MatrixView &a, const MatrixView &b,
+                   float alpha) {
+  matmul_into(c, a.transpose(), b, alpha, 1.0f);
+}
+
+void matmul_nt_acc(Matrix &c, const MatrixView &a, const MatrixView &b,
+                   float alpha) {
+  matmul_into(c, a, b.transpose(), alpha, 1.0f);
+}
+
 } // namespace Dendrite
@@ -2,46 +2,62 @@
 #define MATRIX_H
 #include <cassert>
 #include <cmath>
+#include "core/Pool.hpp"
+#include "math/MatrixExpr.hpp"
+#include "math/MatrixView.hpp"
+#include <algorithm>
 #include <cstddef>
 #include <functional>
+#include <utility>
 #include <vector>
 
 namespace Dendrite {
-class Matrix {
+class Matrix : public MatrixExpr<Matrix> {
 private:
   size_t m_rows;
   size_t m_cols;
-  std::vector<float> m_elements;
+  PoolVector<float> m_elements; // 64 byte aligned, drawn from the pool
+  float *m_borrowed = nullptr;  // someone else's storage, see borrow()
 
 public:
   Matrix() {
     m_rows = 0;
     m_cols = 0;
-    m_elements = std::vector<float>();
+    m_elements = PoolVector<float>();
   }
 
   Matrix(size_t rows, size_t cols) {
     this->m_rows = rows;
     this->m_cols = cols;
-    this->m_elements = std::vector<float>(rows * cols, 0.0f);
+    this->m_elements = PoolVector<float>(rows * cols, 0.0f);
   }
 
   Matrix(size_t rows, size_t cols, float fillVal) {
     this->m_rows = rows;
     this->m_cols = cols;
-    this->m_elements = std::vector<float>(rows * cols, fillVal);
+    this->m_elements = PoolVector<float>(rows * cols, fillVal);
   }
 
-  Matrix(const Matrix &mat) {
-    this->m_rows = mat.m_rows;
-    this->m_cols = mat.m_cols;
-    this->m_elements = std::vector<float>(mat.get_data());
+  Matrix(const Matrix &mat)
+      : m_rows(mat.m_rows), m_cols(mat.m_cols),
+        m_elements(mat.data(), mat.data() + mat.size()) {}
+
+  // Takes the buffer, leaves mat empty (0 x 0). A borrowed mat is copied
+  // and left as is.
+  Matrix(Matrix &&mat) noexcept : m_rows(mat.m_rows), m_cols(mat.m_cols) {
+    if (mat.borrowed()) {
+      m_elements.assign(mat.data(), mat.data() + mat.size());
+      return;
+    }
+    m_elements = std::move(mat.m_elements);
+    mat.m_rows = 0;
+    mat.m_cols = 0;
   }
 
   Matrix(float (&data)[], size_t rows, size_t cols) {
     this->m_rows = rows;
     this->m_cols = cols;
-    this->m_elements = std::vector<float>(rows * cols);
+    this->m_elements = PoolVector<float>(rows * cols);
 
     for (size_t i = 0; i < rows; i++) {
       for (size_t j = 0; j < cols; j++) {
@@ -53,7 +69,7 @@ public:
   template <int rows, int cols> Matrix(float (&data)[rows][cols]) {
     this->m_rows = rows;
     this->m_cols = cols;
-    this->m_elements = std::vector<float>(rows * cols);
+    this->m_elements = PoolVector<float>(rows * cols);
 
     for (int i = 0; i < rows; i++) {
       for (int j = 0; j < cols; j++) {
@@ -62,45 +78,105 @@ public:
     }
   }
 
+  // Evaluates an expression tree (see MatrixExpr.hpp) in one pass.
+  template <typename E>
+  Matrix(const MatrixExpr<E> &expr)
+      : m_rows(expr.self().rows()), m_cols(expr.self().cols()),
+        m_elements(m_rows * m_cols) {
+    assign_expr(expr.self());
+  }
+
   float get(size_t i, size_t j) const;
 
-  // could look into optimizing this by returning reference,
-  // but wouldn't be consistent with current get_col implementation
+  // copies, prefer row()/col() unless the result must outlive this matrix
   Matrix get_row(size_t i) const;
 
   Matrix get_col(size_t j) const;
 
+  MatrixView view() const { return MatrixView(*this); }
+
+  MatrixView row(size_t i) const { return view().row(i); }
+
+  MatrixView col(size_t j) const { return view().col(j); }
+
+  MatrixView block(size_t i, size_t j, size_t rows, size_t cols) const {
+    return view().block(i, j, rows, cols);
+  }
+
   void set(size_t i, size_t j, float val);
 
   void set_data(std::vector<float> data);
 
   void set_data(size_t i, float f);
 
-  void set_data_from(const Matrix &mat);
+  void set_data_from(const MatrixView &mat);
 
-  const std::vector<float> &get_data() const { return this->m_elements; }
+  // owned storage only, see borrow()
+  const PoolVector<float> &get_data() const {
+    assert(!borrowed());
+    return this->m_elements;
+  }
+
+  float *data() {
+    return m_borrowed != nullptr ? m_borrowed : m_elements.data();
+  }
+  const float *data() const {
+    return m_borrowed != nullptr ? m_borrowed : m_elements.data();
+  }
+
+  // Drops the matrix's own storage and makes it a rows x cols window onto
+  // data, which must outlive it. A borrowed matrix stays tied to data:
+  // assigning to it writes through (shapes must match), copying or moving
+  // from it copies the values out, and it can't change size.
+  void borrow(float *data, size_t rows, size_t cols) {
+    m_elements = PoolVector<float>();
+    m_borrowed = data;
+    m_rows = rows;
+    m_cols = cols;
+  }
+
+  bool borrowed() const { return m_borrowed != nullptr; }
 
   size_t rows() const { return m_rows; }
 
   size_t cols() const { return m_cols; }
 
+  size_t size() const { return m_rows * m_cols; }
+
+  // Reshapes to rows x cols, reusing the buffer when it's big enough. Old
+  // values are kept in storage order, new ones are 0. Meant for out-params
+  // that are overwritten anyway. Borrowed matrices can only be reshaped.
+  void resize(size_t rows, size_t cols);
+
+  // Makes room for n elements up front, so resizes up to n don't allocate
+  void reserve(size_t n) {
+    assert(!borrowed());
+    m_elements.reserve(n);
+  }
+  size_t capacity() const { return m_elements.capacity(); } // 0 if borrowed
+
+  void fill(float val);
+
   Matrix &scale_inplace(float s);
 
   Matrix scale(float s) const;
 
-  Matrix dot_multiply(const Matrix &other) const;
+  Matrix dot_multiply(const MatrixView &other) const;
 
-  Matrix elem_multiply(const Matrix &other) const;
+  Matrix elem_multiply(const MatrixView &other) const;
 
-  Matrix &elem_multiply_inplace(const Matrix &other);
+  Matrix &elem_multiply_inplace(const MatrixView &other);
 
   Matrix add(float x) const;
 
   Matrix &add_inplace(float x);
 
-  Matrix add(const Matrix &other) const;
+  Matrix add(const MatrixView &other) const;
 
-  Matrix &add_inplace(const Matrix &other);
+  Matrix &add_inplace(const MatrixView &other);
+
+  // this -= s * other
+  Matrix &sub_inplace(const MatrixView &other, float s = 1.0f);
 
   Matrix pow_elem(float p) const;
 
@@ -109,23 +185,72 @@ public:
   Matrix transpose() const;
 
   Matrix operator*(const Matrix &other) const { return dot_multiply(other); }
-  Matrix operator*(float f) const { return scale(f); }
-  friend Matrix operator*(float f, const Matrix &other) { return other * f; }
+  Matrix operator*(const MatrixView &other) const {
+    return dot_multiply(other);
+  }
 
-  Matrix operator+(const Matrix &other) const { return add(other); }
   const Matrix &operator+=(const Matrix &other) { return add_inplace(other); }
-  const Matrix &operator-=(const Matrix &other) {
-    return add_inplace(other.scale(-1.0f));
+  const Matrix &operator-=(const Matrix &other) { return sub_inplace(other); }
+
+  template <typename E> const Matrix &operator+=(const MatrixExpr<E> &expr) {
+    assert(expr.self().rows() == m_rows && expr.self().cols() == m_cols);
+    float *out = data();
+    const E &e = expr.self();
+    if (e.aliases(out, out + size()))
+      return *this += Matrix(e);
+    for (size_t i = 0; i < size(); i++)
+      out[i] += e.eval(i);
+    return *this;
+  }
+
+  template <typename E> const Matrix &operator-=(const MatrixExpr<E> &expr) {
+    assert(expr.self().rows() == m_rows && expr.self().cols() == m_cols);
+    float *out = data();
+    const E &e = expr.self();
+    if (e.aliases(out, out + size()))
+      return *this -= Matrix(e);
+    for (size_t i = 0; i < size(); i++)
+      out[i] -= e.eval(i);
+    return *this;
   }
-  Matrix operator-(const Matrix &other) const {
-    return add(other.scale(-1.0f));
+
+  template <typename E> Matrix &operator=(const MatrixExpr<E> &expr) {
+    const E &e = expr.self();
+    // e.g. m = m.view().transpose(), which would overwrite elements it has
+    // yet to read: evaluated aside first
+    if (e.aliases(data(), data() + size()))
+      return *this = Matrix(e);
+    if (e.rows() != m_rows || e.cols() != m_cols)
+      resize(e.rows(), e.cols());
+    assign_expr(e);
+    return *this;
   }
 
   Matrix &operator=(const Matrix &other) {
+    if (this == &other)
+      return *this;
+
+    if (borrowed()) {
+      assert(same_shape(other));
+      std::copy(other.data(), other.data() + other.size(), data());
+    } else {
+      m_elements.assign(other.data(), other.data() + other.size());
+      m_cols = other.m_cols;
+      m_rows = other.m_rows;
+    }
+    return *this;
+  }
+
+  Matrix &operator=(Matrix &&other) noexcept {
+    if (borrowed() || other.borrowed())
+      return *this = static_cast<const Matrix &>(other);
+
     if (this != &other) {
-      m_elements = other.m_elements;
+      m_elements = std::move(other.m_elements);
       m_cols = other.m_cols;
       m_rows = other.m_rows;
+      other.m_rows = 0;
+      other.m_cols = 0;
     }
 
     return *this;
@@ -135,13 +260,124 @@ public:
 
   Matrix &apply_function_inplace(std::function<float(float)> func);
 
-  bool same_shape(const Matrix &other) const;
+  bool same_shape(const MatrixView &other) const;
 
   void print() const;
 
   static Matrix
   with_same_shape(const Matrix &other); // creates matrix with same shape
+
+private:
+  template <typename E> void assign_expr(const E &e) {
+    float *out = data();
+    for (size_t i = 0; i < size(); i++)
+      out[i] = e.eval(i);
+  }
+
+  void assign_expr(const MatrixView &view); // strided copy
 };
+
+inline MatrixView::MatrixView(const Matrix &mat)
+    : MatrixView(mat.data(), mat.rows(), mat.cols(), mat.cols(), 1) {}
+
+// Products with transposed operands. The transposes are stride swaps on
+// views, so the operands are read in place and never copied.
+Matrix matmul_tn(const MatrixView &a, const MatrixView &b); // a^T * b
+Matrix matmul_nt(const MatrixView &a, const MatrixView &b); // a * b^T
+Matrix matmul_tt(const MatrixView &a, const MatrixView &b); // a^T * b^T
+
+// c = alpha * a * b + beta * c into an existing destination. Pass
+// a.transpose() / b.transpose() for transposed operands.
+void matmul_into(Matrix &c, const MatrixView &a, const MatrixView &b,
+                 float alpha = 1.0f, float beta = 0.0f);
+
+// c += alpha * op(a) * op(b), e.g. summing weight gradients over a batch
+void matmul_acc(Matrix &c, const MatrixView &a, const MatrixView &b,
+                float alpha = 1.0f);
+void matmul_tn_acc(Matrix &c, const MatrixView &a, const MatrixView &b,
+                   float alpha = 1.0f);
+void matmul_nt_acc(Matrix &c, const MatrixView &a, const MatrixView &b,
+                   float alpha = 1.0f);
+
+// out[i] = sum_j a(i, j) + beta * out[i], e.g. bias gradients summed over a
+// batch of columns. out must be a.rows() x 1.
+void row_sums_into(Matrix &out, const MatrixView &a, float beta = 0.0f);
+
+// MatrixExpr's eager forwarders, see MatrixExpr.hpp. The in-place ones
+// update the freshly evaluated copy and return it.
+template <typename E> Matrix MatrixExpr<E>::eval() const {
+  return Matrix(self());
+}
+template <typename E> float MatrixExpr<E>::get(size_t i, size_t j) const {
+  assert(i < self().rows() && j < self().cols());
+  return self().eval(i * self().cols() + j);
+}
+template <typename E> Matrix MatrixExpr<E>::get_row(size_t i) const {
+  return eval().get_row(i);
+}
+template <typename E> Matrix MatrixExpr<E>::get_col(size_t j) const {
+  return eval().get_col(j);
+}
+template <typename E>
+Matrix MatrixExpr<E>::dot_multiply(const MatrixView &other) const {
+  return eval().dot_multiply(other);
+}
+template <typename E> Matrix MatrixExpr<E>::transpose() const {
+  return eval().transpose();
+}
+template <typename E> void MatrixExpr<E>::print() const { eval().print(); }
+
+template <typename E> Matrix MatrixExpr<E>::scale_inplace(float s) const {
+  Matrix out = eval();
+  out.scale_inplace(s);
+  return out;
+}
+template <typename E>
+Matrix MatrixExpr<E>::elem_multiply_inplace(const MatrixView &other) const {
+  Matrix out = eval();
+  out.elem_multiply_inplace(other);
+  return out;
+}
+template <typename E> Matrix MatrixExpr<E>::add_inplace(float x) const {
+  Matrix out = eval();
+  out.add_inplace(x);
+  return out;
+}
+template <typename E>
+Matrix MatrixExpr<E>::add_inplace(const MatrixView &other) const {
+  Matrix out = eval();
+  out.add_inplace(other);
+  return out;
+}
+template <typename E> Matrix MatrixExpr<E>::pow_elem_inplace(float p) const {
+  Matrix out = eval();
+  out.pow_elem_inplace(p);
+  return out;
+}
+
+template <typename E> Matrix MatrixExpr<E>::scale(float s) const {
+  return scale_inplace(s);
+}
+template <typename E>
+Matrix MatrixExpr<E>::elem_multiply(const MatrixView &other) const {
+  return elem_multiply_inplace(other);
+}
+template <typename E> Matrix MatrixExpr<E>::add(float x) const {
+  return add_inplace(x);
+}
+template <typename E>
+Matrix MatrixExpr<E>::add(const MatrixView &other) const {
+  return add_inplace(other);
+}
+template <typename E> Matrix MatrixExpr<E>::pow_elem(float p) const {
+  return pow_elem_inplace(p);
+}
+
+// Matrix product with a lazy left operand: materialize it, then multiply.
+template <typename E>
+Matrix operator*(const MatrixExpr<E> &lhs, const Matrix &rhs) {
+  return Matrix(lhs.self()).dot_multiply(rhs);
+}
 } // namespace Dendrite
 
 #endif // !MATRIX_H
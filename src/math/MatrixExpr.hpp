@@ -0,0 +1,160 @@
+#ifndef MATRIX_EXPR_H
+#define MATRIX_EXPR_H
+#include <cassert>
+#include <cstddef>
+
+namespace Dendrite {
+class Matrix;
+class MatrixView;
+
+// Lazy elementwise expressions over matrices. Operators build a tree of
+// these nodes, and nothing is computed until a Matrix is constructed from,
+// assigned from, or updated (+=, -=) with the tree. That happens in a single
+// loop with no temporaries. Every node has rows(), cols() and eval(i), the
+// value of flat element i, and aliases(begin, end), true when evaluating
+// element i reads an element of [begin, end) other than begin[i]. Such a
+// tree can't be written over that range as it is evaluated, see
+// Matrix::operator=. Nodes hold references into their operands, so
+// build and consume an expression in one statement, or call eval() to keep
+// the result: auto d = (a - b).eval();
+//
+// The rest of the eager Matrix API also works on an expression, e.g.
+// (x - truth).pow_elem_inplace(2).scale(0.5f). Each of those materializes
+// the tree into a new Matrix first and returns a Matrix by value, the
+// in-place ones included. They are defined in Matrix.hpp.
+template <typename E> class MatrixExpr {
+public:
+  const E &self() const { return static_cast<const E &>(*this); }
+
+  Matrix eval() const;
+
+  float get(size_t i, size_t j) const;
+  Matrix get_row(size_t i) const;
+  Matrix get_col(size_t j) const;
+  Matrix scale(float s) const;
+  Matrix scale_inplace(float s) const;
+  Matrix dot_multiply(const MatrixView &other) const;
+  Matrix elem_multiply(const MatrixView &other) const;
+  Matrix elem_multiply_inplace(const MatrixView &other) const;
+  Matrix add(float x) const;
+  Matrix add_inplace(float x) const;
+  Matrix add(const MatrixView &other) const;
+  Matrix add_inplace(const MatrixView &other) const;
+  Matrix pow_elem(float p) const;
+  Matrix pow_elem_inplace(float p) const;
+  Matrix transpose() const;
+  void print() const;
+};
+
+// Leaf node: a view of a Matrix's elements.
+class MatrixLeaf : public MatrixExpr<MatrixLeaf> {
+private:
+  const float *m_data;
+  size_t m_rows;
+  size_t m_cols;
+
+public:
+  template <typename M>
+  explicit MatrixLeaf(const M &mat)
+      : m_data(mat.data()), m_rows(mat.rows()), m_cols(mat.cols()) {}
+
+  size_t rows() const { return m_rows; }
+  size_t cols() const { return m_cols; }
+  float eval(size_t i) const { return m_data[i]; }
+  bool aliases(const float *begin, const float *end) const {
+    return m_data != begin && m_data < end && begin < m_data + m_rows * m_cols;
+  }
+};
+
+// Matrices enter a tree as leaves, sub-expressions are held by value.
+template <typename E> struct ExprOperand {
+  typedef E type;
+};
+template <> struct ExprOperand<Matrix> {
+  typedef MatrixLeaf type;
+};
+
+struct AddOp {
+  static float apply(float a, float b) { return a + b; }
+};
+struct SubOp {
+  static float apply(float a, float b) { return a - b; }
+};
+
+template <typename L, typename R, typename Op>
+class BinaryExpr : public MatrixExpr<BinaryExpr<L, R, Op>> {
+private:
+  L m_lhs;
+  R m_rhs;
+
+public:
+  BinaryExpr(const L &lhs, const R &rhs) : m_lhs(lhs), m_rhs(rhs) {
+    assert(lhs.rows() == rhs.rows() && lhs.cols() == rhs.cols());
+  }
+
+  size_t rows() const { return m_lhs.rows(); }
+  size_t cols() const { return m_lhs.cols(); }
+  using MatrixExpr<BinaryExpr<L, R, Op>>::eval;
+  float eval(size_t i) const { return Op::apply(m_lhs.eval(i), m_rhs.eval(i)); }
+  bool aliases(const float *begin, const float *end) const {
+    return m_lhs.aliases(begin, end) || m_rhs.aliases(begin, end);
+  }
+};
+
+template <typename E> class ScaleExpr : public MatrixExpr<ScaleExpr<E>> {
+private:
+  E m_expr;
+  float m_scale;
+
+public:
+  ScaleExpr(const E &expr, float s) : m_expr(expr), m_scale(s) {}
+
+  size_t rows() const { return m_expr.rows(); }
+  size_t cols() const { return m_expr.cols(); }
+  using MatrixExpr<ScaleExpr<E>>::eval;
+  float eval(size_t i) const { return m_expr.eval(i) * m_scale; }
+  bool aliases(const float *begin, const float *end) const {
+    return m_expr.aliases(begin, end);
+  }
+};
+
+template <typename L, typename R>
+BinaryExpr<typename ExprOperand<L>::type, typename ExprOperand<R>::type, AddOp>
+operator+(const MatrixExpr<L> &lhs, const MatrixExpr<R> &rhs) {
+  return {typename ExprOperand<L>::type(lhs.self()),
+          typename ExprOperand<R>::type(rhs.self())};
+}
+
+template <typename L, typename R>
+BinaryExpr<typename ExprOperand<L>::type, typename ExprOperand<R>::type, SubOp>
+operator-(const MatrixExpr<L> &lhs, const MatrixExpr<R> &rhs) {
+  return {typename ExprOperand<L>::type(lhs.self()),
+          typename ExprOperand<R>::type(rhs.self())};
+}
+
+template <typename E>
+ScaleExpr<typename ExprOperand<E>::type> operator*(const MatrixExpr<E> &expr,
+                                                   float s) {
+  return {typename ExprOperand<E>::type(expr.self()), s};
+}
+
+template <typename E>
+ScaleExpr<typename ExprOperand<E>::type> operator*(float s,
+                                                   const MatrixExpr<E> &expr) {
+  return {typename ExprOperand<E>::type(expr.self()), s};
+}
+
+template <typename E>
+ScaleExpr<typename ExprOperand<E>::type> operator/(const MatrixExpr<E> &expr,
+                                                   float s) {
+  return {typename ExprOperand<E>::type(expr.self()), 1.0f / s};
+}
+
+template <typename E>
+ScaleExpr<typename ExprOperand<E>::type>
+operator-(const MatrixExpr<E> &expr) {
+  return {typename ExprOperand<E>::type(expr.self()), -1.0f};
+}
+} // namespace Dendrite
+
+#endif // !MATRIX_EXPR_H
@@ -0,0 +1,88 @@
+#ifndef MATRIX_VIEW_H
+#define MATRIX_VIEW_H
+#include "math/MatrixExpr.hpp"
+#include <cassert>
+#include <cstddef>
+
+namespace Dendrite {
+// Non-owning, read-only window onto matrix elements. Element (i, j) lives at
+// data()[i * row_stride() + j * col_stride()], where data() is the source's
+// buffer advanced by the view's offset. Rows, columns, blocks and transposes
+// of a view are views too, so none of them copy. A view is only valid while
+// its source is alive and not resized.
+class MatrixView : public MatrixExpr<MatrixView> {
+private:
+  const float *m_data;
+  size_t m_rows;
+  size_t m_cols;
+  size_t m_rowStride;
+  size_t m_colStride;
+
+public:
+  MatrixView(const float *data, size_t rows, size_t cols, size_t rowStride,
+             size_t colStride)
+      : m_data(data), m_rows(rows), m_cols(cols), m_rowStride(rowStride),
+        m_colStride(colStride) {}
+
+  MatrixView(const Matrix &mat); // whole matrix, defined in Matrix.hpp
+
+  const float *data() const { return m_data; }
+  size_t rows() const { return m_rows; }
+  size_t cols() const { return m_cols; }
+  size_t size() const { return m_rows * m_cols; }
+  size_t row_stride() const { return m_rowStride; }
+  size_t col_stride() const { return m_colStride; }
+
+  // True when the elements are packed row-major with no gaps
+  bool contiguous() const {
+    return (m_rows <= 1 || m_rowStride == m_cols) &&
+           (m_cols <= 1 || m_colStride == 1);
+  }
+
+  float get(size_t i, size_t j) const {
+    assert(i < m_rows && j < m_cols);
+    return m_data[i * m_rowStride + j * m_colStride];
+  }
+
+  // flat row-major index, so views can be used in matrix expressions
+  float eval(size_t i) const {
+    return m_data[(i / m_cols) * m_rowStride + (i % m_cols) * m_colStride];
+  }
+
+  // see MatrixExpr: only a row-major view starting at begin reads element i
+  // for element i
+  bool aliases(const float *begin, const float *end) const {
+    if (size() == 0)
+      return false;
+    const float *last =
+        m_data + (m_rows - 1) * m_rowStride + (m_cols - 1) * m_colStride;
+    if (m_data >= end || last < begin)
+      return false;
+    return !(contiguous() && m_data == begin);
+  }
+
+  MatrixView row(size_t i) const {
+    assert(i < m_rows);
+    return MatrixView(m_data + i * m_rowStride, 1, m_cols, m_rowStride,
+                      m_colStride);
+  }
+
+  MatrixView col(size_t j) const {
+    assert(j < m_cols);
+    return MatrixView(m_data + j * m_colStride, m_rows, 1, m_rowStride,
+                      m_colStride);
+  }
+
+  MatrixView block(size_t i, size_t j, size_t rows, size_t cols) const {
+    assert(i + rows <= m_rows && j + cols <= m_cols);
+    return MatrixView(m_data + i * m_rowStride + j * m_colStride, rows, cols,
+                      m_rowStride, m_colStride);
+  }
+
+  MatrixView transpose() const {
+    return MatrixView(m_data, m_cols, m_rows, m_colStride, m_rowStride);
+  }
+};
+} // namespace Dendrite
+
+#endif // !MATRIX_VIEW_H
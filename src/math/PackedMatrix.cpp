@@ -0,0 +1,59 @@
+#include "PackedMatrix.hpp"
+#include "math/ActivationFunction.hpp"
+#include "math/simd/Kernels.hpp"
+#include <algorithm>
+#include <cassert>
+
+namespace Dendrite {
+namespace {
+// Rows handled per kernel call, so bias and activation run while the
+// outputs are still in L1. A multiple of every panel width.
+constexpr size_t CHUNK_ROWS = 64;
+} // namespace
+
+void PackedMatrix::pack(const MatrixView &mat) {
+  m_rows = mat.rows();
+  m_cols = mat.cols();
+  m_panel = kernels().gemvPanel;
+
+  const size_t panels = (m_rows + m_panel - 1) / m_panel;
+  m_data.assign(panels * m_panel * m_cols, 0.0f);
+
+  float *out = m_data.data();
+  for (size_t r = 0; r < m_rows; r += m_panel) {
+    const size_t rows = std::min(m_panel, m_rows - r);
+    for (size_t p = 0; p < m_cols; p++) {
+      for (size_t i = 0; i < rows; i++) {
+        out[p * m_panel + i] = mat.get(r + i, p);
+      }
+    }
+    out += m_panel * m_cols;
+  }
+}
+
+void PackedMatrix::clear() {
+  m_rows = m_cols = m_panel = 0;
+  m_data.clear();
+  m_data.shrink_to_fit();
+}
+
+void PackedMatrix::gemv(const float *x, float *y,
+                        const GemmEpilogue *ep) const {
+  assert(!empty() && m_panel == kernels().gemvPanel);
+  assert(ep == nullptr || ep->fn == nullptr || ep->rso == 1);
+  assert(ep == nullptr || ep->outBf16 == nullptr);
+  const Kernels &k = kernels();
+
+  for (size_t r = 0; r < m_rows; r += CHUNK_ROWS) {
+    const size_t rows = std::min(CHUNK_ROWS, m_rows - r);
+    k.gemv_packed(rows, m_cols, m_data.data() + r * m_cols, x, y + r);
+
+    if (ep == nullptr)
+      continue;
+    if (ep->bias != nullptr)
+      k.add(y + r, ep->bias + r, y + r, rows);
+    if (ep->fn != nullptr)
+      ep->fn->activate_span(y + r, ep->out + r, rows);
+  }
+}
+} // namespace Dendrite
@@ -0,0 +1,40 @@
+#ifndef PACKED_MATRIX_H
+#define PACKED_MATRIX_H
+
+#include "core/Pool.hpp"
+#include "math/Gemm.hpp"
+#include "math/MatrixView.hpp"
+
+namespace Dendrite {
+// Read-only copy of a weight matrix laid out for matrix-vector products:
+// rows are grouped into panels of kernels().gemvPanel, and each panel is
+// stored column by column, so y = W * x streams W once, front to back, with
+// one vector FMA per column. The last panel is zero padded.
+//
+// Packing costs a full copy of W, so it's done once, when a model is frozen
+// for inference, and must be redone whenever W changes.
+class PackedMatrix {
+private:
+  size_t m_rows = 0;
+  size_t m_cols = 0;
+  size_t m_panel = 0;
+  PoolVector<float> m_data;
+
+public:
+  PackedMatrix() {}
+  explicit PackedMatrix(const MatrixView &mat) { pack(mat); }
+
+  void pack(const MatrixView &mat);
+  void clear();
+
+  bool empty() const { return m_data.empty(); }
+  size_t rows() const { return m_rows; }
+  size_t cols() const { return m_cols; }
+
+  // y = W * x, for contiguous x (cols values) and y (rows values). With an
+  // epilogue, y also gets the bias and ep->out = fn(y); ep->rso must be 1.
+  void gemv(const float *x, float *y, const GemmEpilogue *ep = nullptr) const;
+};
+} // namespace Dendrite
+
+#endif // !PACKED_MATRIX_H
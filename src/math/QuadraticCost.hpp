@@ -7,13 +7,18 @@
 namespace Dendrite {
 class QuadraticCost : public CostFunction {
 public:
-  Matrix cost(const Matrix &x, const Matrix &truth) const override {
+  Matrix cost(const MatrixView &x, const MatrixView &truth) const override {
     return ((x - truth).pow_elem_inplace(2)).scale(0.5f);
   }
 
-  Matrix deriv(const Matrix &x, const Matrix &truth) const override {
+  Matrix deriv(const MatrixView &x, const MatrixView &truth) const override {
     return (x - truth);
   }
+
+  void deriv_into(const MatrixView &x, const MatrixView &truth,
+                  Matrix &out) const override {
+    out = x - truth;
+  }
 };
 } // namespace Dendrite
 
@@ -3,43 +3,41 @@
 
 #include "Matrix.hpp"
 #include "math/ActivationFunction.hpp"
+#include "math/simd/Kernels.hpp"
 namespace Dendrite {
 class ReLU : ActivationFunction {
-private:
-  static float relu(float x) {
-    if (x >= 0) {
-      return x;
-    } else {
-      return 0;
-    }
-  }
-
-  static float relu_deriv(float x) {
-    if (x >= 0) {
-      return 1;
-    } else {
-      return 0;
-    }
-  }
-
 public:
   Matrix activate(const Matrix &input) const override {
-    return input.apply_function(relu);
+    Matrix out(input.rows(), input.cols());
+    vec_relu(input.data(), out.data(), input.size());
+    return out;
   }
 
   Matrix deriv(const Matrix &input) const override {
-    return input.apply_function(relu_deriv);
+    Matrix out(input.rows(), input.cols());
+    vec_relu_deriv(input.data(), out.data(), input.size());
+    return out;
   }
 
   Matrix &activate_inplace(Matrix &input) const override {
-    input.apply_function_inplace(relu);
+    vec_relu(input.data(), input.data(), input.size());
     return input;
   }
 
   Matrix &deriv_inplace(Matrix &input) const override {
-    input.apply_function_inplace(relu_deriv);
+    vec_relu_deriv(input.data(), input.data(), input.size());
     return input;
   }
+
+  void activate_span(const float *in, float *out, size_t n) const override {
+    vec_relu(in, out, n);
+  }
+
+  void deriv_span(const float *in, float *out, size_t n) const override {
+    vec_relu_deriv(in, out, n);
+  }
+
+  bool elementwise() const override { return true; }
 };
 } // namespace Dendrite
 
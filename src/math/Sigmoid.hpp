@@ -2,36 +2,42 @@
 #define SIGMOID_H
 
 #include "math/ActivationFunction.hpp"
-#include <cmath>
+#include "math/simd/Kernels.hpp"
 
 namespace Dendrite {
 class Sigmoid : ActivationFunction {
-private:
-  static float sigmoid(float x) { return 1.0f / (1 + std::exp(-x)); }
-  static float sigmoid_deriv(float x) {
-    //(1 + e^-x)^-1
-    //-(1+e^(-x))^(-2) * e^(-x) * (-1)
-    return std::pow(1 + std::exp(-x), -2) * std::exp(-x);
-  }
-
 public:
   Matrix activate(const Matrix &input) const override {
-    return input.apply_function(sigmoid);
+    Matrix out(input.rows(), input.cols());
+    vec_sigmoid(input.data(), out.data(), input.size());
+    return out;
   }
 
   Matrix deriv(const Matrix &input) const override {
-    return input.apply_function(sigmoid_deriv);
+    Matrix out(input.rows(), input.cols());
+    vec_sigmoid_deriv(input.data(), out.data(), input.size());
+    return out;
   }
 
   Matrix &activate_inplace(Matrix &input) const override {
-    input.apply_function_inplace(sigmoid);
+    vec_sigmoid(input.data(), input.data(), input.size());
     return input;
   }
 
   Matrix &deriv_inplace(Matrix &input) const override {
-    input.apply_function_inplace(sigmoid_deriv);
+    vec_sigmoid_deriv(input.data(), input.data(), input.size());
     return input;
   }
+
+  void activate_span(const float *in, float *out, size_t n) const override {
+    vec_sigmoid(in, out, n);
+  }
+
+  void deriv_span(const float *in, float *out, size_t n) const override {
+    vec_sigmoid_deriv(in, out, n);
+  }
+
+  bool elementwise() const override { return true; }
 };
 } // namespace Dendrite
 
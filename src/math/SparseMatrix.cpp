@@ -0,0 +1,91 @@
+#include "SparseMatrix.hpp"
+#include "math/ActivationFunction.hpp"
+#include "math/simd/Kernels.hpp"
+#include <algorithm>
+#include <cassert>
+
+namespace Dendrite {
+namespace {
+// Rows handled per kernel call, so bias and activation run while the
+// outputs are still in cache
+constexpr size_t CHUNK_ROWS = 16;
+} // namespace
+
+void SparseMatrix::compress(const MatrixView &mat) {
+  m_rows = mat.rows();
+  m_cols = mat.cols();
+  m_rowStart.assign(1, 0);
+  m_colIndex.clear();
+  m_values.clear();
+
+  for (size_t i = 0; i < m_rows; i++) {
+    for (size_t j = 0; j < m_cols; j++) {
+      const float w = mat.get(i, j);
+      if (w == 0.0f)
+        continue;
+      m_colIndex.push_back(j);
+      m_values.push_back(w);
+    }
+    m_rowStart.push_back(m_values.size());
+  }
+  m_colIndex.shrink_to_fit();
+  m_values.shrink_to_fit();
+}
+
+void SparseMatrix::clear() {
+  m_rows = m_cols = 0;
+  PoolVector<uint32_t>().swap(m_rowStart);
+  PoolVector<uint32_t>().swap(m_colIndex);
+  PoolVector<float>().swap(m_values);
+}
+
+void SparseMatrix::multiply(const MatrixView &b, float *c, size_t ldc,
+                            const GemmEpilogue *ep) const {
+  assert(!empty() && b.rows() == m_cols);
+  assert(ep == nullptr || ep->outBf16 == nullptr);
+  const Kernels &k = kernels();
+  const size_t n = b.cols();
+
+  // the kernel wants B's rows contiguous, a lone column packed too
+  const float *bData = b.data();
+  size_t ldb = b.row_stride();
+  if (n == 1 ? ldb != 1 : b.col_stride() != 1) {
+    thread_local PoolVector<float> gathered;
+    gathered.resize(b.size());
+    for (size_t i = 0; i < b.rows(); i++) {
+      for (size_t j = 0; j < n; j++)
+        gathered[i * n + j] = b.get(i, j);
+    }
+    bData = gathered.data();
+    ldb = n;
+  }
+
+  for (size_t r = 0; r < m_rows; r += CHUNK_ROWS) {
+    const size_t rows = std::min(CHUNK_ROWS, m_rows - r);
+    float *out = c + r * ldc;
+    k.spmm_csr(rows, n, m_rowStart.data() + r, m_colIndex.data(),
+               m_values.data(), bData, ldb, out, ldc);
+
+    if (ep == nullptr)
+      continue;
+    for (size_t i = 0; i < rows; i++) {
+      float *row = out + i * ldc;
+      if (ep->bias != nullptr)
+        k.add_scalar(row, ep->bias[r + i], row, n);
+      if (ep->fn != nullptr)
+        ep->fn->activate_span(row, ep->out + (r + i) * ep->rso, n);
+    }
+  }
+}
+
+float zero_fraction(const MatrixView &mat) {
+  if (mat.size() == 0)
+    return 0.0f;
+  size_t zeros = 0;
+  for (size_t i = 0; i < mat.rows(); i++) {
+    for (size_t j = 0; j < mat.cols(); j++)
+      zeros += mat.get(i, j) == 0.0f;
+  }
+  return (float)zeros / mat.size();
+}
+} // namespace Dendrite
@@ -0,0 +1,48 @@
+#ifndef SPARSE_MATRIX_H
+#define SPARSE_MATRIX_H
+
+#include "core/Pool.hpp"
+#include "math/Gemm.hpp"
+#include "math/MatrixView.hpp"
+#include <cstdint>
+
+namespace Dendrite {
+// Read-only copy of a mostly zero weight matrix in CSR form: the nonzeros
+// row by row, each with its column, and where every row starts. Products
+// with a dense matrix then only touch the nonzeros, one broadcast and a row
+// of B per nonzero.
+//
+// Like PackedMatrix it's a copy made when a model is frozen for inference,
+// and must be redone whenever W changes.
+class SparseMatrix {
+private:
+  size_t m_rows = 0;
+  size_t m_cols = 0;
+  PoolVector<uint32_t> m_rowStart; // rows + 1 of them
+  PoolVector<uint32_t> m_colIndex;
+  PoolVector<float> m_values;
+
+public:
+  SparseMatrix() {}
+  explicit SparseMatrix(const MatrixView &mat) { compress(mat); }
+
+  // Keeps mat's nonzeros, exact zeros are dropped
+  void compress(const MatrixView &mat);
+  void clear();
+
+  bool empty() const { return m_rowStart.empty(); }
+  size_t rows() const { return m_rows; }
+  size_t cols() const { return m_cols; }
+  size_t nonzeros() const { return m_values.size(); }
+
+  // C = W * B for B (cols x n), C rows ldc apart. With an epilogue, C also
+  // gets the bias and ep->out = fn(C), the same as gemm_bias_act().
+  void multiply(const MatrixView &b, float *c, size_t ldc,
+                const GemmEpilogue *ep = nullptr) const;
+};
+
+// Fraction of mat's elements that are exactly zero
+float zero_fraction(const MatrixView &mat);
+} // namespace Dendrite
+
+#endif // !SPARSE_MATRIX_H
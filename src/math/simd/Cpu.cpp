@@ -0,0 +1,31 @@
+#include "Cpu.hpp"
+
+namespace Dendrite {
+SimdLevel detect_simd_level() {
+#if defined(__x86_64__) || defined(__i386__)
+  // __builtin_cpu_supports also checks XCR0, so a level is only reported
+  // when the OS saves the wider registers on context switch
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return SimdLevel::AVX512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return SimdLevel::AVX2;
+  if (__builtin_cpu_supports("sse4.2"))
+    return SimdLevel::SSE42;
+#endif
+  return SimdLevel::SCALAR;
+}
+
+const char *simd_level_name(SimdLevel level) {
+  switch (level) {
+  case SimdLevel::AVX512:
+    return "avx512";
+  case SimdLevel::AVX2:
+    return "avx2";
+  case SimdLevel::SSE42:
+    return "sse4.2";
+  default:
+    return "scalar";
+  }
+}
+} // namespace Dendrite
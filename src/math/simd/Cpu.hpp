@@ -0,0 +1,13 @@
+#ifndef CPU_H
+#define CPU_H
+
+namespace Dendrite {
+enum class SimdLevel { SCALAR = 0, SSE42 = 1, AVX2 = 2, AVX512 = 3 };
+
+// Highest instruction set both the CPU and the OS support.
+SimdLevel detect_simd_level();
+
+const char *simd_level_name(SimdLevel level);
+} // namespace Dendrite
+
+#endif // !CPU_H
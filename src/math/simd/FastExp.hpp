@@ -0,0 +1,29 @@
+#ifndef FAST_EXP_H
+#define FAST_EXP_H
+
+namespace Dendrite {
+// Polynomial exp shared by every kernel level, so they agree to an ulp.
+//
+// exp(x) = 2^n * exp(r), n = round(x / ln2), |r| <= ln2 / 2, with exp(r) from
+// a degree 7 polynomial (Cephes expf coefficients) and ln2 split in two so
+// r keeps full precision. Inputs are clamped to [EXP_MIN, EXP_MAX], where
+// 2^n stays a normal float: larger ones give exp(88) ~ 1.65e38 instead of
+// inf, smaller ones ~1.6e-38 instead of a denormal or 0. Within that range
+// the relative error against a double precision exp is below 2e-7 (about 2
+// ulp).
+namespace fast_exp_consts {
+constexpr float EXP_MIN = -87.0f;
+constexpr float EXP_MAX = 88.0f;
+constexpr float LOG2E = 1.44269504088896341f;
+constexpr float LN2_HI = 0.693359375f;
+constexpr float LN2_LO = -2.12194440e-4f;
+constexpr float P0 = 1.9875691500e-4f;
+constexpr float P1 = 1.3981999507e-3f;
+constexpr float P2 = 8.3334519073e-3f;
+constexpr float P3 = 4.1665795894e-2f;
+constexpr float P4 = 1.6666665459e-1f;
+constexpr float P5 = 5.0000001201e-1f;
+} // namespace fast_exp_consts
+} // namespace Dendrite
+
+#endif // !FAST_EXP_H
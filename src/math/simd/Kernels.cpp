@@ -0,0 +1,346 @@
+#include "Kernels.hpp"
+#include "FastExp.hpp"
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+namespace Dendrite {
+namespace {
+void scale(const float *x, float s, float *out, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = x[i] * s;
+}
+
+void add_scalar(const float *x, float s, float *out, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = x[i] + s;
+}
+
+void add(const float *x, const float *y, float *out, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = x[i] + y[i];
+}
+
+void mul(const float *x, const float *y, float *out, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = x[i] * y[i];
+}
+
+void axpy(float a, const float *x, float *y, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    y[i] += a * x[i];
+}
+
+void pow(const float *x, float p, float *out, size_t n) {
+  if (p == 2.0f) {
+    mul(x, x, out, n);
+    return;
+  }
+  for (size_t i = 0; i < n; i++)
+    out[i] = std::pow(x[i], p);
+}
+
+// Four lanes as GNU vectors: a scalar loop over the clamped polynomial
+// doesn't vectorize unless FP compares are allowed to not trap.
+typedef float Quad __attribute__((vector_size(4 * sizeof(float))));
+typedef int32_t QuadInt __attribute__((vector_size(4 * sizeof(int32_t))));
+
+Quad exp4(Quad x) {
+  using namespace fast_exp_consts;
+  const Quad zero = {};
+  x = x > EXP_MAX ? zero + EXP_MAX : x;
+  x = x < EXP_MIN ? zero + EXP_MIN : x;
+
+  // round to nearest by pushing the fraction out of the mantissa
+  const float magic = 12582912.0f; // 1.5 * 2^23
+  const Quad t = (x * LOG2E + magic) - magic;
+  const Quad r = x - t * LN2_HI - t * LN2_LO;
+
+  Quad p = zero + P0;
+  p = p * r + P1;
+  p = p * r + P2;
+  p = p * r + P3;
+  p = p * r + P4;
+  p = p * r + P5;
+  const Quad er = p * r * r + r + 1.0f;
+
+  const QuadInt bits = (__builtin_convertvector(t, QuadInt) + 127) << 23;
+  return er * (Quad)bits;
+}
+
+Quad sigmoid4(Quad x) { return 1.0f / (1.0f + exp4(-x)); }
+
+// s * (1 - s) rather than e^-x / (1 + e^-x)^2, which is inf / inf for
+// large negative x
+Quad sigmoid_deriv4(Quad x) {
+  const Quad s = sigmoid4(x);
+  return s * (1.0f - s);
+}
+
+template <Quad (*F)(Quad)> void map4(const float *x, float *out, size_t n) {
+  Quad v;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    std::memcpy(&v, x + i, sizeof(v));
+    v = F(v);
+    std::memcpy(out + i, &v, sizeof(v));
+  }
+  if (i < n) {
+    float tail[4] = {};
+    std::memcpy(tail, x + i, (n - i) * sizeof(float));
+    std::memcpy(&v, tail, sizeof(v));
+    v = F(v);
+    std::memcpy(out + i, &v, (n - i) * sizeof(float));
+  }
+}
+
+void relu(const float *x, float *out, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = x[i] >= 0.0f ? x[i] : 0.0f;
+}
+
+void relu_deriv(const float *x, float *out, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = x[i] >= 0.0f ? 1.0f : 0.0f;
+}
+
+void momentum(const MomentumStep &s, const float *g, float *v, float *w,
+              size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    const float gi = s.gradScale * g[i];
+    v[i] = s.momentum * v[i] + gi;
+    w[i] -= s.learningRate * (s.nesterov ? gi + s.momentum * v[i] : v[i]);
+  }
+}
+
+void adam(const AdamStep &s, const float *g, float *m, float *v, float *w,
+          size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    const float gi = s.gradScale * g[i] + s.l2 * w[i];
+    m[i] = s.beta1 * m[i] + (1.0f - s.beta1) * gi;
+    v[i] = s.beta2 * v[i] + (1.0f - s.beta2) * gi * gi;
+    w[i] -= s.stepSize * m[i] / (std::sqrt(v[i] * s.invCorr2) + s.eps) +
+            s.decay * w[i];
+  }
+}
+
+void to_bf16_span(const float *x, BFloat16 *out, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = to_bf16(x[i]);
+}
+
+void from_bf16_span(const BFloat16 *x, float *out, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = to_float(x[i]);
+}
+
+void dot_u8s8(size_t rows, size_t cols, size_t k, const int8_t *w,
+              const uint8_t *x, int32_t *out, size_t ldo) {
+  for (size_t r = 0; r < rows; r++) {
+    for (size_t j = 0; j < cols; j++) {
+      int32_t sum = 0;
+      for (size_t p = 0; p < k; p++)
+        sum += (int32_t)w[r * k + p] *
+               (int32_t)x[((p / 4) * cols + j) * 4 + p % 4];
+      out[r * ldo + j] = sum;
+    }
+  }
+}
+
+// Portable register tile. Written so the compiler keeps acc in registers and
+// vectorizes the j loop with whatever the baseline ISA offers.
+template <size_t MR, size_t NR>
+void gemm_generic(size_t kc, const float *a, const float *b, float *c,
+                  size_t rsc, size_t csc, float alpha, float beta) {
+  float acc[MR][NR] = {};
+
+  for (size_t p = 0; p < kc; p++) {
+    for (size_t i = 0; i < MR; i++) {
+      const float ai = a[p * MR + i];
+      for (size_t j = 0; j < NR; j++) {
+        acc[i][j] += ai * b[p * NR + j];
+      }
+    }
+  }
+
+  for (size_t i = 0; i < MR; i++) {
+    for (size_t j = 0; j < NR; j++) {
+      float &cij = c[i * rsc + j * csc];
+      cij = beta == 0.0f ? alpha * acc[i][j] : alpha * acc[i][j] + beta * cij;
+    }
+  }
+}
+
+constexpr size_t GEMV_PANEL = 8;
+
+// Half a panel column as one GNU vector. Left to itself the compiler
+// vectorizes along k with strided loads, which is slower than not packing.
+typedef float Half __attribute__((vector_size(GEMV_PANEL / 2 * sizeof(float))));
+
+inline Half load_half(const float *p) {
+  Half v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+void gemv_packed(size_t rows, size_t k, const float *packed, const float *x,
+                 float *y) {
+  constexpr size_t H = GEMV_PANEL / 2;
+
+  for (size_t r = 0; r < rows; r += GEMV_PANEL) {
+    // two accumulators per half, over even and odd columns
+    Half lo0 = {}, hi0 = {}, lo1 = {}, hi1 = {};
+    size_t p = 0;
+    for (; p + 2 <= k; p += 2) {
+      const float *w = packed + p * GEMV_PANEL;
+      lo0 += load_half(w) * x[p];
+      hi0 += load_half(w + H) * x[p];
+      lo1 += load_half(w + GEMV_PANEL) * x[p + 1];
+      hi1 += load_half(w + GEMV_PANEL + H) * x[p + 1];
+    }
+    if (p < k) {
+      lo0 += load_half(packed + p * GEMV_PANEL) * x[p];
+      hi0 += load_half(packed + p * GEMV_PANEL + H) * x[p];
+    }
+
+    float sum[GEMV_PANEL];
+    const Half lo = lo0 + lo1, hi = hi0 + hi1;
+    std::memcpy(sum, &lo, sizeof(lo));
+    std::memcpy(sum + H, &hi, sizeof(hi));
+    for (size_t i = 0; i < GEMV_PANEL && r + i < rows; i++) {
+      y[r + i] = sum[i];
+    }
+    packed += GEMV_PANEL * k;
+  }
+}
+
+void spmm_csr(size_t rows, size_t n, const uint32_t *rowStart,
+              const uint32_t *colIndex, const float *values, const float *b,
+              size_t ldb, float *c, size_t ldc) {
+  for (size_t r = 0; r < rows; r++) {
+    float *out = c + r * ldc;
+    for (size_t j = 0; j < n; j++)
+      out[j] = 0.0f;
+    for (uint32_t i = rowStart[r]; i < rowStart[r + 1]; i++)
+      axpy(values[i], b + (size_t)colIndex[i] * ldb, out, n);
+  }
+}
+
+const Kernels s_scalar = {
+    SimdLevel::SCALAR,
+    scale,
+    add_scalar,
+    add,
+    mul,
+    axpy,
+    pow,
+    map4<exp4>,
+    map4<sigmoid4>,
+    map4<sigmoid_deriv4>,
+    relu,
+    relu_deriv,
+    momentum,
+    adam,
+    to_bf16_span,
+    from_bf16_span,
+    dot_u8s8,
+    {"generic", gemm_generic<4, 8>, 4, 8, 128, 256, 4096},
+    GEMV_PANEL,
+    gemv_packed,
+    spmm_csr,
+};
+
+SimdLevel level_cap() {
+  const char *env = std::getenv("DENDRITE_SIMD");
+  if (env == nullptr)
+    return SimdLevel::AVX512;
+  if (std::strcmp(env, "scalar") == 0)
+    return SimdLevel::SCALAR;
+  if (std::strcmp(env, "sse4.2") == 0)
+    return SimdLevel::SSE42;
+  if (std::strcmp(env, "avx2") == 0)
+    return SimdLevel::AVX2;
+  return SimdLevel::AVX512;
+}
+
+MathMode initial_math_mode() {
+  const char *env = std::getenv("DENDRITE_MATH");
+  if (env != nullptr && std::strcmp(env, "exact") == 0)
+    return MathMode::EXACT;
+  return MathMode::FAST;
+}
+
+std::atomic<MathMode> &math_mode_state() {
+  static std::atomic<MathMode> mode{initial_math_mode()};
+  return mode;
+}
+
+const Kernels &select_kernels() {
+  SimdLevel level = detect_simd_level();
+  SimdLevel cap = level_cap();
+  if (cap < level)
+    level = cap;
+
+  switch (level) {
+  case SimdLevel::AVX512:
+    return avx512_kernels();
+  case SimdLevel::AVX2:
+    return avx2_kernels();
+  case SimdLevel::SSE42:
+    return sse42_kernels();
+  default:
+    return scalar_kernels();
+  }
+}
+} // namespace
+
+const Kernels &scalar_kernels() { return s_scalar; }
+
+const Kernels &kernels() {
+  static const Kernels &selected = select_kernels();
+  return selected;
+}
+
+void set_math_mode(MathMode mode) { math_mode_state().store(mode); }
+
+MathMode math_mode() { return math_mode_state().load(); }
+
+void vec_exp(const float *x, float *out, size_t n) {
+  if (math_mode() == MathMode::FAST) {
+    kernels().exp(x, out, n);
+    return;
+  }
+  for (size_t i = 0; i < n; i++)
+    out[i] = std::exp(x[i]);
+}
+
+void vec_sigmoid(const float *x, float *out, size_t n) {
+  if (math_mode() == MathMode::FAST) {
+    kernels().sigmoid(x, out, n);
+    return;
+  }
+  for (size_t i = 0; i < n; i++)
+    out[i] = 1.0f / (1.0f + std::exp(-x[i]));
+}
+
+void vec_sigmoid_deriv(const float *x, float *out, size_t n) {
+  if (math_mode() == MathMode::FAST) {
+    kernels().sigmoid_deriv(x, out, n);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) {
+    const float s = 1.0f / (1.0f + std::exp(-x[i]));
+    out[i] = s * (1.0f - s);
+  }
+}
+
+void vec_relu(const float *x, float *out, size_t n) {
+  kernels().relu(x, out, n);
+}
+
+void vec_relu_deriv(const float *x, float *out, size_t n) {
+  kernels().relu_deriv(x, out, n);
+}
+} // namespace Dendrite
@@ -0,0 +1,118 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "math/BFloat16.hpp"
+#include "math/Gemm.hpp"
+#include "math/simd/Cpu.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace Dendrite {
+// One optimizer step's constants, see Kernels::momentum and Kernels::adam.
+// Gradients come in summed over a batch and are scaled by gradScale first.
+struct MomentumStep {
+  float gradScale;
+  float learningRate;
+  float momentum;
+  bool nesterov;
+};
+
+struct AdamStep {
+  float gradScale;
+  float beta1, beta2, eps;
+  float l2;       // adds l2 * w to the gradient (Adam's weight decay)
+  float decay;    // subtracts decay * w after the step (AdamW's)
+  float stepSize; // learning rate / (1 - beta1^t)
+  float invCorr2; // 1 / (1 - beta2^t)
+};
+
+// Flat float kernels over n contiguous elements. out may alias an input.
+struct Kernels {
+  SimdLevel level;
+
+  void (*scale)(const float *x, float s, float *out, size_t n);
+  void (*add_scalar)(const float *x, float s, float *out, size_t n);
+  void (*add)(const float *x, const float *y, float *out, size_t n);
+  void (*mul)(const float *x, const float *y, float *out, size_t n);
+  void (*axpy)(float a, const float *x, float *y, size_t n); // y += a * x
+  void (*pow)(const float *x, float p, float *out, size_t n);
+
+  // Activations and their derivatives. exp and the sigmoids use the
+  // polynomial exp from FastExp.hpp; see vec_exp() and friends for the
+  // versions that honour math_mode().
+  void (*exp)(const float *x, float *out, size_t n);
+  void (*sigmoid)(const float *x, float *out, size_t n);
+  void (*sigmoid_deriv)(const float *x, float *out, size_t n);
+  void (*relu)(const float *x, float *out, size_t n);
+  void (*relu_deriv)(const float *x, float *out, size_t n);
+
+  // Fused optimizer updates of n parameters w from gradients g, in one
+  // pass that also updates the per-parameter state.
+  //   momentum: v = momentum * v + g, w -= lr * v
+  //             (w -= lr * (g + momentum * v) when nesterov)
+  //   adam:     m = b1 * m + (1 - b1) * g, v = b2 * v + (1 - b2) * g^2,
+  //             w -= stepSize * m / (sqrt(v * invCorr2) + eps) + decay * w
+  void (*momentum)(const MomentumStep &s, const float *g, float *v, float *w,
+                   size_t n);
+  void (*adam)(const AdamStep &s, const float *g, float *m, float *v,
+               float *w, size_t n);
+
+  // Narrowing rounds to nearest even. Where the CPU has AVX-512 BF16 that
+  // is done in hardware, which also flushes denormals to zero.
+  void (*to_bf16)(const float *x, BFloat16 *out, size_t n);
+  void (*from_bf16)(const BFloat16 *x, float *out, size_t n);
+
+  // Integer products for int8 inference, exact in int32:
+  //   out[r * ldo + j] = sum_p w[r * k + p] * x(p, j)
+  // over rows rows of int8 weights and cols columns of uint8 inputs. x is
+  // interleaved four k at a time, the layout vpdpbusd consumes:
+  //   x(p, j) = x[((p / 4) * cols + j) * 4 + p % 4]
+  // k must be a multiple of 4 and cols of QUANT_COLS.
+  void (*dot_u8s8)(size_t rows, size_t cols, size_t k, const int8_t *w,
+                   const uint8_t *x, int32_t *out, size_t ldo);
+
+  GemmKernel gemm;
+
+  // y = W * x over weights packed by PackedMatrix: panels of gemvPanel rows,
+  // each stored k-major (gemvPanel values per column). Writes rows outputs.
+  size_t gemvPanel;
+  void (*gemv_packed)(size_t rows, size_t k, const float *packed,
+                      const float *x, float *y);
+
+  // C = A * B for a sparse A (rows x k) in CSR form and a dense, row-major
+  // B (k x n, rows ldb apart), into row-major C (rows ldc apart). Row r of
+  // A holds values[i] at column colIndex[i], for i in
+  // [rowStart[r], rowStart[r + 1]).
+  void (*spmm_csr)(size_t rows, size_t n, const uint32_t *rowStart,
+                   const uint32_t *colIndex, const float *values,
+                   const float *b, size_t ldb, float *c, size_t ldc);
+};
+
+constexpr size_t QUANT_COLS = 16;
+
+// Kernel table for the best level this machine supports. Chosen once, on
+// first use; DENDRITE_SIMD=scalar|sse4.2|avx2|avx512 caps the level.
+const Kernels &kernels();
+
+const Kernels &scalar_kernels();
+const Kernels &sse42_kernels();
+const Kernels &avx2_kernels();
+const Kernels &avx512_kernels();
+
+// FAST (the default) evaluates exp through the polynomial in FastExp.hpp,
+// EXACT through std::exp one element at a time. DENDRITE_MATH=exact|fast
+// sets the starting mode.
+enum class MathMode { EXACT, FAST };
+
+void set_math_mode(MathMode mode);
+MathMode math_mode();
+
+// Mode-aware activation kernels over n contiguous values, out may alias x.
+void vec_exp(const float *x, float *out, size_t n);
+void vec_sigmoid(const float *x, float *out, size_t n);
+void vec_sigmoid_deriv(const float *x, float *out, size_t n);
+void vec_relu(const float *x, float *out, size_t n);
+void vec_relu_deriv(const float *x, float *out, size_t n);
+} // namespace Dendrite
+
+#endif // !KERNELS_H
@@ -0,0 +1,504 @@
+#include "Kernels.hpp"
+#include "FastExp.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+
+namespace Dendrite {
+namespace {
+TARGET_AVX2 void scale(const float *x, float s, float *out, size_t n) {
+  const __m256 vs = _mm256_set1_ps(s);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(x + i), vs));
+  for (; i < n; i++)
+    out[i] = x[i] * s;
+}
+
+TARGET_AVX2 void add_scalar(const float *x, float s, float *out, size_t n) {
+  const __m256 vs = _mm256_set1_ps(s);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(x + i), vs));
+  for (; i < n; i++)
+    out[i] = x[i] + s;
+}
+
+TARGET_AVX2 void add(const float *x, const float *y, float *out, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(x + i),
+                                            _mm256_loadu_ps(y + i)));
+  for (; i < n; i++)
+    out[i] = x[i] + y[i];
+}
+
+TARGET_AVX2 void mul(const float *x, const float *y, float *out, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(x + i),
+                                            _mm256_loadu_ps(y + i)));
+  for (; i < n; i++)
+    out[i] = x[i] * y[i];
+}
+
+TARGET_AVX2 void axpy(float a, const float *x, float *y, size_t n) {
+  const __m256 va = _mm256_set1_ps(a);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i),
+                                            _mm256_loadu_ps(y + i)));
+  for (; i < n; i++)
+    y[i] += a * x[i];
+}
+
+TARGET_AVX2 void pow(const float *x, float p, float *out, size_t n) {
+  if (p == 2.0f) {
+    mul(x, x, out, n);
+    return;
+  }
+  scalar_kernels().pow(x, p, out, n);
+}
+
+// exp over 8 lanes, see FastExp.hpp for the method and error bound.
+TARGET_AVX2 inline __m256 exp8(__m256 x) {
+  using namespace fast_exp_consts;
+  // constant first, so a NaN x comes through as NaN
+  x = _mm256_min_ps(_mm256_set1_ps(EXP_MAX),
+                    _mm256_max_ps(_mm256_set1_ps(EXP_MIN), x));
+
+  const __m256 t = _mm256_round_ps(
+      _mm256_mul_ps(x, _mm256_set1_ps(LOG2E)),
+      _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  const __m256 hi = _mm256_fnmadd_ps(t, _mm256_set1_ps(LN2_HI), x);
+  const __m256 r = _mm256_fnmadd_ps(t, _mm256_set1_ps(LN2_LO), hi);
+
+  __m256 p = _mm256_set1_ps(P0);
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(P1));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(P2));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(P3));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(P4));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(P5));
+  const __m256 er = _mm256_fmadd_ps(_mm256_mul_ps(p, r), r,
+                                    _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+  const __m256i bits = _mm256_slli_epi32(
+      _mm256_add_epi32(_mm256_cvtps_epi32(t), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(er, _mm256_castsi256_ps(bits));
+}
+
+TARGET_AVX2 inline __m256 sigmoid8(__m256 x) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 e = exp8(_mm256_sub_ps(_mm256_setzero_ps(), x));
+  return _mm256_div_ps(one, _mm256_add_ps(one, e));
+}
+
+TARGET_AVX2 inline __m256 sigmoid_deriv8(__m256 x) {
+  const __m256 s = sigmoid8(x);
+  return _mm256_mul_ps(s, _mm256_sub_ps(_mm256_set1_ps(1.0f), s));
+}
+
+TARGET_AVX2 inline __m256 relu8(__m256 x) {
+  return _mm256_max_ps(x, _mm256_setzero_ps());
+}
+
+TARGET_AVX2 inline __m256 relu_deriv8(__m256 x) {
+  const __m256 ge = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GE_OQ);
+  return _mm256_and_ps(ge, _mm256_set1_ps(1.0f));
+}
+
+// Applies F over n values, the tail through a zero padded vector.
+template <__m256 (*F)(__m256)>
+TARGET_AVX2 void map8(const float *x, float *out, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(out + i, F(_mm256_loadu_ps(x + i)));
+  if (i < n) {
+    float tail[8] = {};
+    std::copy(x + i, x + n, tail);
+    _mm256_storeu_ps(tail, F(_mm256_loadu_ps(tail)));
+    std::copy(tail, tail + (n - i), out + i);
+  }
+}
+
+TARGET_AVX2 void momentum(const MomentumStep &s, const float *g, float *v,
+                          float *w, size_t n) {
+  const __m256 gs = _mm256_set1_ps(s.gradScale);
+  const __m256 mu = _mm256_set1_ps(s.momentum);
+  const __m256 lr = _mm256_set1_ps(s.learningRate);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 gi = _mm256_mul_ps(gs, _mm256_loadu_ps(g + i));
+    const __m256 vi = _mm256_fmadd_ps(mu, _mm256_loadu_ps(v + i), gi);
+    const __m256 d = s.nesterov ? _mm256_fmadd_ps(mu, vi, gi) : vi;
+    _mm256_storeu_ps(v + i, vi);
+    _mm256_storeu_ps(w + i, _mm256_fnmadd_ps(lr, d, _mm256_loadu_ps(w + i)));
+  }
+  if (i < n)
+    scalar_kernels().momentum(s, g + i, v + i, w + i, n - i);
+}
+
+// One Adam step over 8 lanes, updating m, v and w in place.
+TARGET_AVX2 inline void adam8(const AdamStep &s, __m256 g, __m256 &m,
+                              __m256 &v, __m256 &w) {
+  g = _mm256_fmadd_ps(_mm256_set1_ps(s.gradScale), g,
+                      _mm256_mul_ps(_mm256_set1_ps(s.l2), w));
+  m = _mm256_fmadd_ps(_mm256_set1_ps(s.beta1), m,
+                      _mm256_mul_ps(_mm256_set1_ps(1.0f - s.beta1), g));
+  v = _mm256_fmadd_ps(_mm256_set1_ps(s.beta2), v,
+                      _mm256_mul_ps(_mm256_set1_ps(1.0f - s.beta2),
+                                    _mm256_mul_ps(g, g)));
+  const __m256 denom = _mm256_add_ps(
+      _mm256_sqrt_ps(_mm256_mul_ps(v, _mm256_set1_ps(s.invCorr2))),
+      _mm256_set1_ps(s.eps));
+  const __m256 step =
+      _mm256_fmadd_ps(_mm256_set1_ps(s.stepSize), _mm256_div_ps(m, denom),
+                      _mm256_mul_ps(_mm256_set1_ps(s.decay), w));
+  w = _mm256_sub_ps(w, step);
+}
+
+TARGET_AVX2 void adam(const AdamStep &s, const float *g, float *m, float *v,
+                      float *w, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 mi = _mm256_loadu_ps(m + i);
+    __m256 vi = _mm256_loadu_ps(v + i);
+    __m256 wi = _mm256_loadu_ps(w + i);
+    adam8(s, _mm256_loadu_ps(g + i), mi, vi, wi);
+    _mm256_storeu_ps(m + i, mi);
+    _mm256_storeu_ps(v + i, vi);
+    _mm256_storeu_ps(w + i, wi);
+  }
+  if (i < n)
+    scalar_kernels().adam(s, g + i, m + i, v + i, w + i, n - i);
+}
+
+// Eight floats to bf16 with integer round to nearest even, NaNs quieted
+TARGET_AVX2 inline __m128i to_bf16_8(__m256 x) {
+  const __m256i bits = _mm256_castps_si256(x);
+  const __m256i lsb =
+      _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+  const __m256i rounded = _mm256_add_epi32(
+      bits, _mm256_add_epi32(lsb, _mm256_set1_epi32(0x7fff)));
+  const __m256i quiet = _mm256_or_si256(bits, _mm256_set1_epi32(0x400000));
+  const __m256i nan = _mm256_castps_si256(_mm256_cmp_ps(x, x, _CMP_UNORD_Q));
+  const __m256i r =
+      _mm256_srli_epi32(_mm256_blendv_epi8(rounded, quiet, nan), 16);
+  return _mm_packus_epi32(_mm256_castsi256_si128(r),
+                          _mm256_extracti128_si256(r, 1));
+}
+
+TARGET_AVX2 void to_bf16(const float *x, BFloat16 *out, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm_storeu_si128((__m128i *)(out + i), to_bf16_8(_mm256_loadu_ps(x + i)));
+  }
+  if (i < n)
+    scalar_kernels().to_bf16(x + i, out + i, n - i);
+}
+
+TARGET_AVX2 void from_bf16(const BFloat16 *x, float *out, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256i wide =
+        _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(x + i)));
+    _mm256_storeu_ps(out + i,
+                     _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16)));
+  }
+  if (i < n)
+    scalar_kernels().from_bf16(x + i, out + i, n - i);
+}
+
+// vpdpbusd without VNNI: the even and odd bytes of x (4 k of 8 columns)
+// are widened to int16 in place and multiplied with the matching weight
+// bytes by vpmaddwd, which sums pairs into int32 exactly. vpmaddubsw would
+// do it in one step but saturates int16. R rows by C vectors of columns.
+template <size_t R, size_t C>
+TARGET_AVX2 inline void dot_block(size_t k, size_t cols, const int8_t *w,
+                                  const uint8_t *x, int32_t *out,
+                                  size_t ldo) {
+  const __m256i lowBytes = _mm256_set1_epi16(0xff);
+  __m256i acc[R][C];
+  for (size_t r = 0; r < R; r++)
+    for (size_t c = 0; c < C; c++)
+      acc[r][c] = _mm256_setzero_si256();
+
+  for (size_t p = 0; p < k; p += 4) {
+    const uint8_t *xp = x + p * cols;
+    __m256i xEven[C], xOdd[C];
+    for (size_t c = 0; c < C; c++) {
+      const __m256i xv = _mm256_loadu_si256((const __m256i *)(xp + c * 32));
+      xEven[c] = _mm256_and_si256(xv, lowBytes);
+      xOdd[c] = _mm256_srli_epi16(xv, 8);
+    }
+    for (size_t r = 0; r < R; r++) {
+      int32_t quad;
+      std::memcpy(&quad, w + r * k + p, sizeof(quad));
+      const __m256i wv = _mm256_set1_epi32(quad);
+      const __m256i wEven = _mm256_srai_epi16(_mm256_slli_epi16(wv, 8), 8);
+      const __m256i wOdd = _mm256_srai_epi16(wv, 8);
+      for (size_t c = 0; c < C; c++) {
+        acc[r][c] = _mm256_add_epi32(
+            acc[r][c], _mm256_add_epi32(_mm256_madd_epi16(xEven[c], wEven),
+                                        _mm256_madd_epi16(xOdd[c], wOdd)));
+      }
+    }
+  }
+
+  for (size_t r = 0; r < R; r++)
+    for (size_t c = 0; c < C; c++)
+      _mm256_storeu_si256((__m256i *)(out + r * ldo + c * 8), acc[r][c]);
+}
+
+TARGET_AVX2 void dot_u8s8(size_t rows, size_t cols, size_t k,
+                          const int8_t *w, const uint8_t *x, int32_t *out,
+                          size_t ldo) {
+  for (size_t j = 0; j < cols; j += 16) {
+    size_t r = 0;
+    for (; r + 4 <= rows; r += 4)
+      dot_block<4, 2>(k, cols, w + r * k, x + j * 4, out + r * ldo + j, ldo);
+    for (; r < rows; r++)
+      dot_block<1, 2>(k, cols, w + r * k, x + j * 4, out + r * ldo + j, ldo);
+  }
+}
+
+// 6x16 tile: 12 ymm accumulators, 2 for the B row, 1 for the A broadcast.
+constexpr size_t MR = 6;
+constexpr size_t NR = 16;
+
+TARGET_AVX2 void gemm_6x16(size_t kc, const float *a, const float *b,
+                           float *c, size_t rsc, size_t csc, float alpha,
+                           float beta) {
+  __m256 acc[MR][2];
+  for (size_t i = 0; i < MR; i++) {
+    acc[i][0] = _mm256_setzero_ps();
+    acc[i][1] = _mm256_setzero_ps();
+  }
+
+  for (size_t p = 0; p < kc; p++) {
+    const __m256 b0 = _mm256_loadu_ps(b + p * NR);
+    const __m256 b1 = _mm256_loadu_ps(b + p * NR + 8);
+    for (size_t i = 0; i < MR; i++) {
+      const __m256 ai = _mm256_broadcast_ss(a + p * MR + i);
+      acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+      acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+    }
+  }
+
+  const __m256 va = _mm256_set1_ps(alpha);
+  const __m256 vb = _mm256_set1_ps(beta);
+  for (size_t i = 0; i < MR; i++) {
+    __m256 r0 = _mm256_mul_ps(va, acc[i][0]);
+    __m256 r1 = _mm256_mul_ps(va, acc[i][1]);
+    float *ci = c + i * rsc;
+
+    if (csc == 1) {
+      if (beta != 0.0f) {
+        r0 = _mm256_fmadd_ps(vb, _mm256_loadu_ps(ci), r0);
+        r1 = _mm256_fmadd_ps(vb, _mm256_loadu_ps(ci + 8), r1);
+      }
+      _mm256_storeu_ps(ci, r0);
+      _mm256_storeu_ps(ci + 8, r1);
+    } else {
+      float row[NR];
+      _mm256_storeu_ps(row, r0);
+      _mm256_storeu_ps(row + 8, r1);
+      for (size_t j = 0; j < NR; j++) {
+        float &cij = ci[j * csc];
+        cij = beta == 0.0f ? row[j] : row[j] + beta * cij;
+      }
+    }
+  }
+}
+
+// One ymm holds a panel's 8 rows. Four accumulators over consecutive
+// columns hide the FMA latency, the stream through W is purely sequential.
+TARGET_AVX2 void gemv_packed_8(size_t rows, size_t k, const float *packed,
+                               const float *x, float *y) {
+  for (size_t r = 0; r < rows; r += 8) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    size_t p = 0;
+    for (; p + 4 <= k; p += 4) {
+      const float *w = packed + p * 8;
+      acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(w), _mm256_set1_ps(x[p]), acc0);
+      acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(w + 8), _mm256_set1_ps(x[p + 1]),
+                             acc1);
+      acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(w + 16),
+                             _mm256_set1_ps(x[p + 2]), acc2);
+      acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(w + 24),
+                             _mm256_set1_ps(x[p + 3]), acc3);
+    }
+    for (; p < k; p++) {
+      acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(packed + p * 8),
+                             _mm256_set1_ps(x[p]), acc0);
+    }
+    const __m256 sum =
+        _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3));
+
+    if (r + 8 <= rows) {
+      _mm256_storeu_ps(y + r, sum);
+    } else {
+      float tail[8];
+      _mm256_storeu_ps(tail, sum);
+      for (size_t i = 0; r + i < rows; i++)
+        y[r + i] = tail[i];
+    }
+    packed += 8 * k;
+  }
+}
+
+// Columns of B and C per sweep over A. The k x 32 slice of B a sweep reads
+// stays in L2 while every row of A goes past it.
+constexpr size_t SPMM_COLS = 32;
+
+// Lanes [0, n) of an 8 wide vector as a maskload/maskstore mask
+TARGET_AVX2 inline __m256i tail_mask8(size_t n) {
+  return _mm256_cmpgt_epi32(_mm256_set1_epi32((int)n),
+                            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+// One row of C over V vectors of columns, the last of them masked. Two
+// nonzeros per iteration into separate accumulators, so there are enough
+// independent FMAs in flight.
+template <size_t V>
+TARGET_AVX2 inline void spmm_row(uint32_t begin, uint32_t end,
+                                 const uint32_t *colIndex, const float *values,
+                                 const float *b, size_t ldb, float *c,
+                                 __m256i last) {
+  const __m256i all = _mm256_set1_epi32(-1);
+  __m256 acc0[V], acc1[V];
+  for (size_t v = 0; v < V; v++)
+    acc0[v] = acc1[v] = _mm256_setzero_ps();
+
+  uint32_t i = begin;
+  for (; i + 2 <= end; i += 2) {
+    const float *b0 = b + (size_t)colIndex[i] * ldb;
+    const float *b1 = b + (size_t)colIndex[i + 1] * ldb;
+    const __m256 w0 = _mm256_set1_ps(values[i]);
+    const __m256 w1 = _mm256_set1_ps(values[i + 1]);
+    for (size_t v = 0; v < V; v++) {
+      const __m256i m = v + 1 == V ? last : all;
+      acc0[v] = _mm256_fmadd_ps(_mm256_maskload_ps(b0 + 8 * v, m), w0,
+                                acc0[v]);
+      acc1[v] = _mm256_fmadd_ps(_mm256_maskload_ps(b1 + 8 * v, m), w1,
+                                acc1[v]);
+    }
+  }
+  if (i < end) {
+    const float *b0 = b + (size_t)colIndex[i] * ldb;
+    const __m256 w0 = _mm256_set1_ps(values[i]);
+    for (size_t v = 0; v < V; v++) {
+      const __m256i m = v + 1 == V ? last : all;
+      acc0[v] = _mm256_fmadd_ps(_mm256_maskload_ps(b0 + 8 * v, m), w0,
+                                acc0[v]);
+    }
+  }
+
+  for (size_t v = 0; v < V; v++) {
+    const __m256i m = v + 1 == V ? last : all;
+    _mm256_maskstore_ps(c + 8 * v, m, _mm256_add_ps(acc0[v], acc1[v]));
+  }
+}
+
+// A single column is a sparse dot product per row, 8 nonzeros at a time
+// with the matching elements of b gathered.
+TARGET_AVX2 void spmv_csr(size_t rows, const uint32_t *rowStart,
+                          const uint32_t *colIndex, const float *values,
+                          const float *b, float *c, size_t ldc) {
+  for (size_t r = 0; r < rows; r++) {
+    __m256 acc = _mm256_setzero_ps();
+    uint32_t i = rowStart[r];
+    for (; i + 8 <= rowStart[r + 1]; i += 8) {
+      const __m256i idx =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(colIndex + i));
+      acc = _mm256_fmadd_ps(_mm256_loadu_ps(values + i),
+                            _mm256_i32gather_ps(b, idx, 4), acc);
+    }
+    float sum[8];
+    _mm256_storeu_ps(sum, acc);
+    float total = ((sum[0] + sum[1]) + (sum[2] + sum[3])) +
+                  ((sum[4] + sum[5]) + (sum[6] + sum[7]));
+    for (; i < rowStart[r + 1]; i++)
+      total += values[i] * b[colIndex[i]];
+    c[r * ldc] = total;
+  }
+}
+
+TARGET_AVX2 void spmm_csr(size_t rows, size_t n, const uint32_t *rowStart,
+                          const uint32_t *colIndex, const float *values,
+                          const float *b, size_t ldb, float *c, size_t ldc) {
+  if (n == 1 && ldb == 1) {
+    spmv_csr(rows, rowStart, colIndex, values, b, c, ldc);
+    return;
+  }
+
+  for (size_t j = 0; j < n; j += SPMM_COLS) {
+    const size_t cols = std::min(SPMM_COLS, n - j);
+    const __m256i last = tail_mask8(cols % 8 == 0 ? 8 : cols % 8);
+    for (size_t r = 0; r < rows; r++) {
+      const uint32_t begin = rowStart[r], end = rowStart[r + 1];
+      float *out = c + r * ldc + j;
+      switch ((cols + 7) / 8) {
+      case 4:
+        spmm_row<4>(begin, end, colIndex, values, b + j, ldb, out, last);
+        break;
+      case 3:
+        spmm_row<3>(begin, end, colIndex, values, b + j, ldb, out, last);
+        break;
+      case 2:
+        spmm_row<2>(begin, end, colIndex, values, b + j, ldb, out, last);
+        break;
+      default:
+        spmm_row<1>(begin, end, colIndex, values, b + j, ldb, out, last);
+      }
+    }
+  }
+}
+
+Kernels make_kernels() {
+  Kernels k = scalar_kernels();
+  k.level = SimdLevel::AVX2;
+  k.scale = scale;
+  k.add_scalar = add_scalar;
+  k.add = add;
+  k.mul = mul;
+  k.axpy = axpy;
+  k.pow = pow;
+  k.exp = map8<exp8>;
+  k.sigmoid = map8<sigmoid8>;
+  k.sigmoid_deriv = map8<sigmoid_deriv8>;
+  k.relu = map8<relu8>;
+  k.relu_deriv = map8<relu_deriv8>;
+  k.momentum = momentum;
+  k.adam = adam;
+  k.to_bf16 = to_bf16;
+  k.from_bf16 = from_bf16;
+  k.dot_u8s8 = dot_u8s8;
+  k.gemm = {"avx2_6x16", gemm_6x16, MR, NR, 144, 256, 4096};
+  k.gemvPanel = 8;
+  k.gemv_packed = gemv_packed_8;
+  k.spmm_csr = spmm_csr;
+  return k;
+}
+} // namespace
+
+const Kernels &avx2_kernels() {
+  static const Kernels k = make_kernels();
+  return k;
+}
+} // namespace Dendrite
+
+#else
+
+namespace Dendrite {
+const Kernels &avx2_kernels() { return scalar_kernels(); }
+} // namespace Dendrite
+
+#endif
@@ -0,0 +1,563 @@
+#include "Kernels.hpp"
+#include "FastExp.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+
+namespace Dendrite {
+namespace {
+// Lanes [0, n) of a 16 wide vector, for the loop tails.
+TARGET_AVX512 inline __mmask16 tail_mask(size_t n) {
+  return (__mmask16)((1u << n) - 1);
+}
+
+TARGET_AVX512 void scale(const float *x, float s, float *out, size_t n) {
+  const __m512 vs = _mm512_set1_ps(s);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_loadu_ps(x + i), vs));
+  if (i < n) {
+    const __mmask16 m = tail_mask(n - i);
+    _mm512_mask_storeu_ps(out + i, m,
+                          _mm512_mul_ps(_mm512_maskz_loadu_ps(m, x + i), vs));
+  }
+}
+
+TARGET_AVX512 void add_scalar(const float *x, float s, float *out, size_t n) {
+  const __m512 vs = _mm512_set1_ps(s);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    _mm512_storeu_ps(out + i, _mm512_add_ps(_mm512_loadu_ps(x + i), vs));
+  if (i < n) {
+    const __mmask16 m = tail_mask(n - i);
+    _mm512_mask_storeu_ps(out + i, m,
+                          _mm512_add_ps(_mm512_maskz_loadu_ps(m, x + i), vs));
+  }
+}
+
+TARGET_AVX512 void add(const float *x, const float *y, float *out, size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    _mm512_storeu_ps(out + i, _mm512_add_ps(_mm512_loadu_ps(x + i),
+                                            _mm512_loadu_ps(y + i)));
+  if (i < n) {
+    const __mmask16 m = tail_mask(n - i);
+    _mm512_mask_storeu_ps(out + i, m,
+                          _mm512_add_ps(_mm512_maskz_loadu_ps(m, x + i),
+                                        _mm512_maskz_loadu_ps(m, y + i)));
+  }
+}
+
+TARGET_AVX512 void mul(const float *x, const float *y, float *out, size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_loadu_ps(x + i),
+                                            _mm512_loadu_ps(y + i)));
+  if (i < n) {
+    const __mmask16 m = tail_mask(n - i);
+    _mm512_mask_storeu_ps(out + i, m,
+                          _mm512_mul_ps(_mm512_maskz_loadu_ps(m, x + i),
+                                        _mm512_maskz_loadu_ps(m, y + i)));
+  }
+}
+
+TARGET_AVX512 void axpy(float a, const float *x, float *y, size_t n) {
+  const __m512 va = _mm512_set1_ps(a);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    _mm512_storeu_ps(y + i, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + i),
+                                            _mm512_loadu_ps(y + i)));
+  if (i < n) {
+    const __mmask16 m = tail_mask(n - i);
+    _mm512_mask_storeu_ps(y + i, m,
+                          _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, x + i),
+                                          _mm512_maskz_loadu_ps(m, y + i)));
+  }
+}
+
+TARGET_AVX512 void pow(const float *x, float p, float *out, size_t n) {
+  if (p == 2.0f) {
+    mul(x, x, out, n);
+    return;
+  }
+  scalar_kernels().pow(x, p, out, n);
+}
+
+// GCC 12 flags the undefined passthrough operand of the unmasked AVX-512
+// intrinsics used here as maybe-uninitialized once they are inlined.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+// exp over 16 lanes, see FastExp.hpp for the method and error bound.
+TARGET_AVX512 inline __m512 exp16(__m512 x) {
+  using namespace fast_exp_consts;
+  // constant first, so a NaN x comes through as NaN
+  x = _mm512_min_ps(_mm512_set1_ps(EXP_MAX),
+                    _mm512_max_ps(_mm512_set1_ps(EXP_MIN), x));
+
+  const __m512 t = _mm512_roundscale_ps(
+      _mm512_mul_ps(x, _mm512_set1_ps(LOG2E)),
+      _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  const __m512 hi = _mm512_fnmadd_ps(t, _mm512_set1_ps(LN2_HI), x);
+  const __m512 r = _mm512_fnmadd_ps(t, _mm512_set1_ps(LN2_LO), hi);
+
+  __m512 p = _mm512_set1_ps(P0);
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(P1));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(P2));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(P3));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(P4));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(P5));
+  const __m512 er = _mm512_fmadd_ps(_mm512_mul_ps(p, r), r,
+                                    _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+
+  const __m512i bits = _mm512_slli_epi32(
+      _mm512_add_epi32(_mm512_cvtps_epi32(t), _mm512_set1_epi32(127)), 23);
+  return _mm512_mul_ps(er, _mm512_castsi512_ps(bits));
+}
+
+TARGET_AVX512 inline __m512 sigmoid16(__m512 x) {
+  const __m512 one = _mm512_set1_ps(1.0f);
+  const __m512 e = exp16(_mm512_sub_ps(_mm512_setzero_ps(), x));
+  return _mm512_div_ps(one, _mm512_add_ps(one, e));
+}
+
+TARGET_AVX512 inline __m512 sigmoid_deriv16(__m512 x) {
+  const __m512 s = sigmoid16(x);
+  return _mm512_mul_ps(s, _mm512_sub_ps(_mm512_set1_ps(1.0f), s));
+}
+
+TARGET_AVX512 inline __m512 relu16(__m512 x) {
+  return _mm512_max_ps(x, _mm512_setzero_ps());
+}
+
+TARGET_AVX512 inline __m512 relu_deriv16(__m512 x) {
+  const __mmask16 ge =
+      _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_GE_OQ);
+  return _mm512_maskz_mov_ps(ge, _mm512_set1_ps(1.0f));
+}
+#pragma GCC diagnostic pop
+
+// Applies F over n values, the tail through masked loads and stores.
+template <__m512 (*F)(__m512)>
+TARGET_AVX512 void map16(const float *x, float *out, size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    _mm512_storeu_ps(out + i, F(_mm512_loadu_ps(x + i)));
+  if (i < n) {
+    const __mmask16 m = tail_mask(n - i);
+    _mm512_mask_storeu_ps(out + i, m, F(_mm512_maskz_loadu_ps(m, x + i)));
+  }
+}
+
+TARGET_AVX512 void momentum(const MomentumStep &s, const float *g, float *v,
+                            float *w, size_t n) {
+  const __m512 gs = _mm512_set1_ps(s.gradScale);
+  const __m512 mu = _mm512_set1_ps(s.momentum);
+  const __m512 lr = _mm512_set1_ps(s.learningRate);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m512 gi = _mm512_mul_ps(gs, _mm512_loadu_ps(g + i));
+    const __m512 vi = _mm512_fmadd_ps(mu, _mm512_loadu_ps(v + i), gi);
+    const __m512 d = s.nesterov ? _mm512_fmadd_ps(mu, vi, gi) : vi;
+    _mm512_storeu_ps(v + i, vi);
+    _mm512_storeu_ps(w + i, _mm512_fnmadd_ps(lr, d, _mm512_loadu_ps(w + i)));
+  }
+  if (i < n) {
+    const __mmask16 k = tail_mask(n - i);
+    const __m512 gi = _mm512_mul_ps(gs, _mm512_maskz_loadu_ps(k, g + i));
+    const __m512 vi =
+        _mm512_fmadd_ps(mu, _mm512_maskz_loadu_ps(k, v + i), gi);
+    const __m512 d = s.nesterov ? _mm512_fmadd_ps(mu, vi, gi) : vi;
+    _mm512_mask_storeu_ps(v + i, k, vi);
+    _mm512_mask_storeu_ps(
+        w + i, k, _mm512_fnmadd_ps(lr, d, _mm512_maskz_loadu_ps(k, w + i)));
+  }
+}
+
+// One Adam step over 16 lanes, updating m, v and w in place.
+#pragma GCC diagnostic push // _mm512_sqrt_ps, as for exp16
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+TARGET_AVX512 inline void adam16(const AdamStep &s, __m512 g, __m512 &m,
+                                 __m512 &v, __m512 &w) {
+  g = _mm512_fmadd_ps(_mm512_set1_ps(s.gradScale), g,
+                      _mm512_mul_ps(_mm512_set1_ps(s.l2), w));
+  m = _mm512_fmadd_ps(_mm512_set1_ps(s.beta1), m,
+                      _mm512_mul_ps(_mm512_set1_ps(1.0f - s.beta1), g));
+  v = _mm512_fmadd_ps(_mm512_set1_ps(s.beta2), v,
+                      _mm512_mul_ps(_mm512_set1_ps(1.0f - s.beta2),
+                                    _mm512_mul_ps(g, g)));
+  const __m512 denom = _mm512_add_ps(
+      _mm512_sqrt_ps(_mm512_mul_ps(v, _mm512_set1_ps(s.invCorr2))),
+      _mm512_set1_ps(s.eps));
+  const __m512 step =
+      _mm512_fmadd_ps(_mm512_set1_ps(s.stepSize), _mm512_div_ps(m, denom),
+                      _mm512_mul_ps(_mm512_set1_ps(s.decay), w));
+  w = _mm512_sub_ps(w, step);
+}
+#pragma GCC diagnostic pop
+
+TARGET_AVX512 void adam(const AdamStep &s, const float *g, float *m, float *v,
+                        float *w, size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 mi = _mm512_loadu_ps(m + i);
+    __m512 vi = _mm512_loadu_ps(v + i);
+    __m512 wi = _mm512_loadu_ps(w + i);
+    adam16(s, _mm512_loadu_ps(g + i), mi, vi, wi);
+    _mm512_storeu_ps(m + i, mi);
+    _mm512_storeu_ps(v + i, vi);
+    _mm512_storeu_ps(w + i, wi);
+  }
+  if (i < n) {
+    const __mmask16 k = tail_mask(n - i);
+    __m512 mi = _mm512_maskz_loadu_ps(k, m + i);
+    __m512 vi = _mm512_maskz_loadu_ps(k, v + i);
+    __m512 wi = _mm512_maskz_loadu_ps(k, w + i);
+    adam16(s, _mm512_maskz_loadu_ps(k, g + i), mi, vi, wi);
+    _mm512_mask_storeu_ps(m + i, k, mi);
+    _mm512_mask_storeu_ps(v + i, k, vi);
+    _mm512_mask_storeu_ps(w + i, k, wi);
+  }
+}
+
+#pragma GCC diagnostic push // the shifts and conversions, as for exp16
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+// Sixteen floats to bf16 with integer round to nearest even, NaNs quieted
+TARGET_AVX512 inline __m512i to_bf16_16(__m512 x) {
+  const __m512i bits = _mm512_castps_si512(x);
+  const __m512i lsb =
+      _mm512_and_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(1));
+  const __m512i rounded = _mm512_add_epi32(
+      bits, _mm512_add_epi32(lsb, _mm512_set1_epi32(0x7fff)));
+  const __m512i quiet = _mm512_or_si512(bits, _mm512_set1_epi32(0x400000));
+  const __mmask16 nan = _mm512_cmp_ps_mask(x, x, _CMP_UNORD_Q);
+  return _mm512_srli_epi32(_mm512_mask_blend_epi32(nan, rounded, quiet), 16);
+}
+
+TARGET_AVX512 void to_bf16(const float *x, BFloat16 *out, size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m512i r = to_bf16_16(_mm512_loadu_ps(x + i));
+    _mm256_storeu_si256((__m256i *)(out + i), _mm512_cvtepi32_epi16(r));
+  }
+  if (i < n) {
+    const __mmask16 m = tail_mask(n - i);
+    _mm512_mask_cvtepi32_storeu_epi16(
+        out + i, m, to_bf16_16(_mm512_maskz_loadu_ps(m, x + i)));
+  }
+}
+
+// VCVTNEPS2BF16 does the rounding in one instruction
+__attribute__((target("avx512f,avx512bf16"))) void
+to_bf16_native(const float *x, BFloat16 *out, size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m256bh r = _mm512_cvtneps_pbh(_mm512_loadu_ps(x + i));
+    _mm256_storeu_si256((__m256i *)(out + i), (__m256i)r);
+  }
+  if (i < n)
+    to_bf16(x + i, out + i, n - i);
+}
+
+TARGET_AVX512 void from_bf16(const BFloat16 *x, float *out, size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m512i wide =
+        _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(x + i)));
+    _mm512_storeu_ps(out + i,
+                     _mm512_castsi512_ps(_mm512_slli_epi32(wide, 16)));
+  }
+  if (i < n)
+    scalar_kernels().from_bf16(x + i, out + i, n - i);
+}
+#pragma GCC diagnostic pop
+
+#define TARGET_VNNI __attribute__((target("avx512f,avx512bw,avx512vnni")))
+
+// vpdpbusd multiplies 64 uint8 x int8 pairs and adds each group of four
+// into an int32 lane: one vector of x is 4 k of 16 columns, matched with
+// 4 weights broadcast to every lane. R rows by C vectors of columns.
+template <size_t R, size_t C>
+TARGET_VNNI inline void dot_block_vnni(size_t k, size_t cols, const int8_t *w,
+                                       const uint8_t *x, int32_t *out,
+                                       size_t ldo) {
+  __m512i acc[R][C];
+  for (size_t r = 0; r < R; r++)
+    for (size_t c = 0; c < C; c++)
+      acc[r][c] = _mm512_setzero_si512();
+
+  for (size_t p = 0; p < k; p += 4) {
+    const uint8_t *xp = x + p * cols;
+    __m512i xv[C];
+    for (size_t c = 0; c < C; c++)
+      xv[c] = _mm512_loadu_si512(xp + c * 64);
+    for (size_t r = 0; r < R; r++) {
+      int32_t quad;
+      std::memcpy(&quad, w + r * k + p, sizeof(quad));
+      const __m512i wv = _mm512_set1_epi32(quad);
+      for (size_t c = 0; c < C; c++)
+        acc[r][c] = _mm512_dpbusd_epi32(acc[r][c], xv[c], wv);
+    }
+  }
+
+  for (size_t r = 0; r < R; r++)
+    for (size_t c = 0; c < C; c++)
+      _mm512_storeu_si512(out + r * ldo + c * 16, acc[r][c]);
+}
+
+TARGET_VNNI void dot_u8s8_vnni(size_t rows, size_t cols, size_t k,
+                               const int8_t *w, const uint8_t *x,
+                               int32_t *out, size_t ldo) {
+  size_t j = 0;
+  for (; j + 32 <= cols; j += 32) {
+    size_t r = 0;
+    for (; r + 8 <= rows; r += 8)
+      dot_block_vnni<8, 2>(k, cols, w + r * k, x + j * 4, out + r * ldo + j,
+                           ldo);
+    for (; r < rows; r++)
+      dot_block_vnni<1, 2>(k, cols, w + r * k, x + j * 4, out + r * ldo + j,
+                           ldo);
+  }
+  for (; j < cols; j += 16) {
+    size_t r = 0;
+    for (; r + 8 <= rows; r += 8)
+      dot_block_vnni<8, 1>(k, cols, w + r * k, x + j * 4, out + r * ldo + j,
+                           ldo);
+    for (; r < rows; r++)
+      dot_block_vnni<1, 1>(k, cols, w + r * k, x + j * 4, out + r * ldo + j,
+                           ldo);
+  }
+}
+
+// 8x32 tile: 16 zmm accumulators, leaving room for B and the A broadcast.
+constexpr size_t MR = 8;
+constexpr size_t NR = 32;
+
+TARGET_AVX512 void gemm_8x32(size_t kc, const float *a, const float *b,
+                             float *c, size_t rsc, size_t csc, float alpha,
+                             float beta) {
+  __m512 acc[MR][2];
+  for (size_t i = 0; i < MR; i++) {
+    acc[i][0] = _mm512_setzero_ps();
+    acc[i][1] = _mm512_setzero_ps();
+  }
+
+  for (size_t p = 0; p < kc; p++) {
+    const __m512 b0 = _mm512_loadu_ps(b + p * NR);
+    const __m512 b1 = _mm512_loadu_ps(b + p * NR + 16);
+    for (size_t i = 0; i < MR; i++) {
+      const __m512 ai = _mm512_set1_ps(a[p * MR + i]);
+      acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+      acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+    }
+  }
+
+  const __m512 va = _mm512_set1_ps(alpha);
+  const __m512 vb = _mm512_set1_ps(beta);
+  for (size_t i = 0; i < MR; i++) {
+    __m512 r0 = _mm512_mul_ps(va, acc[i][0]);
+    __m512 r1 = _mm512_mul_ps(va, acc[i][1]);
+    float *ci = c + i * rsc;
+
+    if (csc == 1) {
+      if (beta != 0.0f) {
+        r0 = _mm512_fmadd_ps(vb, _mm512_loadu_ps(ci), r0);
+        r1 = _mm512_fmadd_ps(vb, _mm512_loadu_ps(ci + 16), r1);
+      }
+      _mm512_storeu_ps(ci, r0);
+      _mm512_storeu_ps(ci + 16, r1);
+    } else {
+      float row[NR];
+      _mm512_storeu_ps(row, r0);
+      _mm512_storeu_ps(row + 16, r1);
+      for (size_t j = 0; j < NR; j++) {
+        float &cij = ci[j * csc];
+        cij = beta == 0.0f ? row[j] : row[j] + beta * cij;
+      }
+    }
+  }
+}
+
+// One zmm holds a panel's 16 rows. Four accumulators over consecutive
+// columns hide the FMA latency, the stream through W is purely sequential.
+TARGET_AVX512 void gemv_packed_16(size_t rows, size_t k, const float *packed,
+                                  const float *x, float *y) {
+  for (size_t r = 0; r < rows; r += 16) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps();
+    __m512 acc3 = _mm512_setzero_ps();
+    size_t p = 0;
+    for (; p + 4 <= k; p += 4) {
+      const float *w = packed + p * 16;
+      acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(w), _mm512_set1_ps(x[p]), acc0);
+      acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(w + 16),
+                             _mm512_set1_ps(x[p + 1]), acc1);
+      acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(w + 32),
+                             _mm512_set1_ps(x[p + 2]), acc2);
+      acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(w + 48),
+                             _mm512_set1_ps(x[p + 3]), acc3);
+    }
+    for (; p < k; p++) {
+      acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(packed + p * 16),
+                             _mm512_set1_ps(x[p]), acc0);
+    }
+    const __m512 sum =
+        _mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3));
+
+    if (r + 16 <= rows) {
+      _mm512_storeu_ps(y + r, sum);
+    } else {
+      _mm512_mask_storeu_ps(y + r, tail_mask(rows - r), sum);
+    }
+    packed += 16 * k;
+  }
+}
+
+// Columns of B and C per sweep over A. The k x 64 slice of B a sweep reads
+// stays in L2 while every row of A goes past it.
+constexpr size_t SPMM_COLS = 64;
+
+// One row of C over V vectors of columns, the last of them masked. Two
+// nonzeros per iteration into separate accumulators, so there are enough
+// independent FMAs in flight.
+template <size_t V>
+TARGET_AVX512 inline void spmm_row(uint32_t begin, uint32_t end,
+                                   const uint32_t *colIndex,
+                                   const float *values, const float *b,
+                                   size_t ldb, float *c, __mmask16 last) {
+  __m512 acc0[V], acc1[V];
+  for (size_t v = 0; v < V; v++)
+    acc0[v] = acc1[v] = _mm512_setzero_ps();
+
+  uint32_t i = begin;
+  for (; i + 2 <= end; i += 2) {
+    const float *b0 = b + (size_t)colIndex[i] * ldb;
+    const float *b1 = b + (size_t)colIndex[i + 1] * ldb;
+    const __m512 w0 = _mm512_set1_ps(values[i]);
+    const __m512 w1 = _mm512_set1_ps(values[i + 1]);
+    for (size_t v = 0; v < V; v++) {
+      const __mmask16 m = v + 1 == V ? last : (__mmask16)0xffff;
+      acc0[v] = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, b0 + 16 * v), w0,
+                                acc0[v]);
+      acc1[v] = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, b1 + 16 * v), w1,
+                                acc1[v]);
+    }
+  }
+  if (i < end) {
+    const float *b0 = b + (size_t)colIndex[i] * ldb;
+    const __m512 w0 = _mm512_set1_ps(values[i]);
+    for (size_t v = 0; v < V; v++) {
+      const __mmask16 m = v + 1 == V ? last : (__mmask16)0xffff;
+      acc0[v] = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, b0 + 16 * v), w0,
+                                acc0[v]);
+    }
+  }
+
+  for (size_t v = 0; v < V; v++) {
+    const __mmask16 m = v + 1 == V ? last : (__mmask16)0xffff;
+    _mm512_mask_storeu_ps(c + 16 * v, m, _mm512_add_ps(acc0[v], acc1[v]));
+  }
+}
+
+// A single column is a sparse dot product per row, 16 nonzeros at a time
+// with the matching elements of b gathered.
+#pragma GCC diagnostic push // _mm512_reduce_add_ps, as for exp16
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+TARGET_AVX512 void spmv_csr(size_t rows, const uint32_t *rowStart,
+                            const uint32_t *colIndex, const float *values,
+                            const float *b, float *c, size_t ldc) {
+  for (size_t r = 0; r < rows; r++) {
+    __m512 acc = _mm512_setzero_ps();
+    for (uint32_t i = rowStart[r]; i < rowStart[r + 1]; i += 16) {
+      const __mmask16 m =
+          tail_mask(std::min<size_t>(16, rowStart[r + 1] - i));
+      const __m512i idx = _mm512_maskz_loadu_epi32(m, colIndex + i);
+      const __m512 x =
+          _mm512_mask_i32gather_ps(_mm512_setzero_ps(), m, idx, b, 4);
+      acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, values + i), x, acc);
+    }
+    c[r * ldc] = _mm512_reduce_add_ps(acc);
+  }
+}
+#pragma GCC diagnostic pop
+
+TARGET_AVX512 void spmm_csr(size_t rows, size_t n, const uint32_t *rowStart,
+                            const uint32_t *colIndex, const float *values,
+                            const float *b, size_t ldb, float *c,
+                            size_t ldc) {
+  if (n == 1 && ldb == 1) {
+    spmv_csr(rows, rowStart, colIndex, values, b, c, ldc);
+    return;
+  }
+
+  for (size_t j = 0; j < n; j += SPMM_COLS) {
+    const size_t cols = std::min(SPMM_COLS, n - j);
+    const __mmask16 last = cols % 16 == 0 ? (__mmask16)0xffff
+                                          : tail_mask(cols % 16);
+    for (size_t r = 0; r < rows; r++) {
+      const uint32_t begin = rowStart[r], end = rowStart[r + 1];
+      float *out = c + r * ldc + j;
+      switch ((cols + 15) / 16) {
+      case 4:
+        spmm_row<4>(begin, end, colIndex, values, b + j, ldb, out, last);
+        break;
+      case 3:
+        spmm_row<3>(begin, end, colIndex, values, b + j, ldb, out, last);
+        break;
+      case 2:
+        spmm_row<2>(begin, end, colIndex, values, b + j, ldb, out, last);
+        break;
+      default:
+        spmm_row<1>(begin, end, colIndex, values, b + j, ldb, out, last);
+      }
+    }
+  }
+}
+
+Kernels make_kernels() {
+  Kernels k = scalar_kernels();
+  k.level = SimdLevel::AVX512;
+  k.scale = scale;
+  k.add_scalar = add_scalar;
+  k.add = add;
+  k.mul = mul;
+  k.axpy = axpy;
+  k.pow = pow;
+  k.exp = map16<exp16>;
+  k.sigmoid = map16<sigmoid16>;
+  k.sigmoid_deriv = map16<sigmoid_deriv16>;
+  k.relu = map16<relu16>;
+  k.relu_deriv = map16<relu_deriv16>;
+  k.momentum = momentum;
+  k.adam = adam;
+  k.to_bf16 = __builtin_cpu_supports("avx512bf16") ? to_bf16_native : to_bf16;
+  k.from_bf16 = from_bf16;
+  if (__builtin_cpu_supports("avx512vnni"))
+    k.dot_u8s8 = dot_u8s8_vnni;
+  else
+    k.dot_u8s8 = avx2_kernels().dot_u8s8;
+  k.gemm = {"avx512_8x32", gemm_8x32, MR, NR, 128, 256, 4096};
+  k.gemvPanel = 16;
+  k.gemv_packed = gemv_packed_16;
+  k.spmm_csr = spmm_csr;
+  return k;
+}
+} // namespace
+
+const Kernels &avx512_kernels() {
+  static const Kernels k = make_kernels();
+  return k;
+}
+} // namespace Dendrite
+
+#else
+
+namespace Dendrite {
+const Kernels &avx512_kernels() { return scalar_kernels(); }
+} // namespace Dendrite
+
+#endif
@@ -0,0 +1,89 @@
+#include "Kernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+
+namespace Dendrite {
+namespace {
+TARGET_SSE42 void scale(const float *x, float s, float *out, size_t n) {
+  const __m128 vs = _mm_set1_ps(s);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(x + i), vs));
+  for (; i < n; i++)
+    out[i] = x[i] * s;
+}
+
+TARGET_SSE42 void add_scalar(const float *x, float s, float *out, size_t n) {
+  const __m128 vs = _mm_set1_ps(s);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(x + i), vs));
+  for (; i < n; i++)
+    out[i] = x[i] + s;
+}
+
+TARGET_SSE42 void add(const float *x, const float *y, float *out, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(out + i,
+                  _mm_add_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+  for (; i < n; i++)
+    out[i] = x[i] + y[i];
+}
+
+TARGET_SSE42 void mul(const float *x, const float *y, float *out, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(out + i,
+                  _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+  for (; i < n; i++)
+    out[i] = x[i] * y[i];
+}
+
+TARGET_SSE42 void axpy(float a, const float *x, float *y, size_t n) {
+  const __m128 va = _mm_set1_ps(a);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i),
+                                    _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+  for (; i < n; i++)
+    y[i] += a * x[i];
+}
+
+TARGET_SSE42 void pow(const float *x, float p, float *out, size_t n) {
+  if (p == 2.0f) {
+    mul(x, x, out, n);
+    return;
+  }
+  scalar_kernels().pow(x, p, out, n);
+}
+
+Kernels make_kernels() {
+  Kernels k = scalar_kernels();
+  k.level = SimdLevel::SSE42;
+  k.scale = scale;
+  k.add_scalar = add_scalar;
+  k.add = add;
+  k.mul = mul;
+  k.axpy = axpy;
+  k.pow = pow;
+  return k;
+}
+} // namespace
+
+const Kernels &sse42_kernels() {
+  static const Kernels k = make_kernels();
+  return k;
+}
+} // namespace Dendrite
+
+#else
+
+namespace Dendrite {
+const Kernels &sse42_kernels() { return scalar_kernels(); }
+} // namespace Dendrite
+
+#endif
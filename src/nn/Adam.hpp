@@ -0,0 +1,48 @@
+#ifndef ADAM_H
+#define ADAM_H
+
+#include "math/simd/Kernels.hpp"
+#include "nn/Optimizer.hpp"
+#include <cassert>
+#include <cmath>
+
+namespace Dendrite {
+// Adam with bias-corrected moments. weightDecay is added to the gradient
+// as an L2 term, or applied straight to the weights when decoupled (AdamW).
+class Adam : Optimizer {
+  float m_beta1;
+  float m_beta2;
+  float m_eps;
+  float m_weightDecay;
+  bool m_decoupled;
+
+public:
+  Adam(float beta1 = 0.9f, float beta2 = 0.999f, float eps = 1e-8f,
+       float weightDecay = 0.0f, bool decoupled = false)
+      : m_beta1(beta1), m_beta2(beta2), m_eps(eps),
+        m_weightDecay(weightDecay), m_decoupled(decoupled) {}
+
+  void update(Matrix &params, const Matrix &grad, OptimizerState &state,
+              float learningRate, float gradScale) const override {
+    assert(params.same_shape(grad));
+
+    state.prepare(params, 2);
+    state.step++;
+    const float t = state.step;
+
+    AdamStep s;
+    s.gradScale = gradScale;
+    s.beta1 = m_beta1;
+    s.beta2 = m_beta2;
+    s.eps = m_eps;
+    s.l2 = m_decoupled ? 0.0f : m_weightDecay;
+    s.decay = m_decoupled ? learningRate * m_weightDecay : 0.0f;
+    s.stepSize = learningRate / (1.0f - std::pow(m_beta1, t));
+    s.invCorr2 = 1.0f / (1.0f - std::pow(m_beta2, t));
+    kernels().adam(s, grad.data(), state.first.data(), state.second.data(),
+                   params.data(), params.size());
+  }
+};
+} // namespace Dendrite
+
+#endif // !ADAM_H
@@ -0,0 +1,107 @@
+#include "BatchPrefetcher.hpp"
+#include <utility>
+
+namespace Dendrite {
+BatchPrefetcher::BatchPrefetcher(const Matrix &x, const Matrix &y,
+                                 size_t batchSize, size_t epochs,
+                                 uint64_t seed, size_t depth,
+                                 Transform transform)
+    : m_sampler(x, y, batchSize, seed), m_epochs(epochs),
+      m_transform(std::move(transform)), m_slots(depth + 1) {
+  for (size_t i = 0; i < m_slots.size(); i++) {
+    m_slots[i].x.reserve(x.rows() * batchSize);
+    m_slots[i].y.reserve(y.rows() * batchSize);
+    m_free.push_back(i);
+  }
+  if (depth > 0)
+    m_producer = std::thread(&BatchPrefetcher::produce, this);
+}
+
+BatchPrefetcher::~BatchPrefetcher() {
+  if (!m_producer.joinable())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_canProduce.notify_one();
+  m_producer.join();
+}
+
+bool BatchPrefetcher::fill(Batch &batch) {
+  while (m_epoch < m_epochs) {
+    if (m_sampler.next(batch.x, batch.y)) {
+      batch.epoch = m_epoch;
+      batch.index = m_index++;
+      if (m_transform)
+        m_transform(batch.x, batch.y);
+      return true;
+    }
+
+    // the sampler starts out on epoch 0
+    if (++m_epoch < m_epochs)
+      m_sampler.start_epoch(m_epoch);
+    m_index = 0;
+  }
+  return false;
+}
+
+void BatchPrefetcher::produce() {
+  while (true) {
+    size_t slot;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_canProduce.wait(lock, [&] { return m_stop || !m_free.empty(); });
+      if (m_stop)
+        return;
+      slot = m_free.front();
+      m_free.pop_front();
+    }
+
+    // the slot is ours alone until it's pushed onto m_ready. An exception
+    // would end the thread and so the process, so it's handed to next().
+    bool more = false;
+    std::exception_ptr error;
+    try {
+      more = fill(m_slots[slot]);
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!more) {
+      m_free.push_front(slot);
+      m_error = std::move(error);
+      m_finished = true;
+      m_canConsume.notify_one();
+      return;
+    }
+    m_ready.push_back(slot);
+    m_canConsume.notify_one();
+  }
+}
+
+const BatchPrefetcher::Batch *BatchPrefetcher::next() {
+  if (!m_producer.joinable())
+    return fill(m_slots[0]) ? &m_slots[0] : nullptr;
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_held != SIZE_MAX) {
+    m_free.push_back(m_held);
+    m_held = SIZE_MAX;
+    m_canProduce.notify_one();
+  }
+
+  m_canConsume.wait(lock, [&] { return m_finished || !m_ready.empty(); });
+  if (m_ready.empty()) {
+    if (m_error)
+      std::rethrow_exception(std::exchange(m_error, nullptr));
+    return nullptr;
+  }
+
+  m_held = m_ready.front();
+  m_ready.pop_front();
+  return &m_slots[m_held];
+}
+} // namespace Dendrite
@@ -0,0 +1,81 @@
+#ifndef BATCH_PREFETCHER_H
+#define BATCH_PREFETCHER_H
+
+#include "math/Matrix.hpp"
+#include "nn/BatchSampler.hpp"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Dendrite {
+// Runs a BatchSampler on a background thread, so batch k + 1 is gathered
+// (and transformed) while the caller trains on batch k. Batches go through
+// a ring of depth + 1 reused buffers: the producer stays at most depth
+// batches ahead and blocks once they're all filled, the consumer blocks
+// only when the producer fell behind. With depth 0 there's no thread and
+// next() gathers in place, for single core machines where a producer would
+// only add context switches.
+class BatchPrefetcher {
+public:
+  struct Batch {
+    Matrix x;
+    Matrix y;
+    size_t epoch;
+    size_t index; // within the epoch
+  };
+
+  // Runs on the producer thread on every gathered batch, e.g. to normalize
+  // or one-hot expand raw data. Must not touch anything the trainer uses.
+  // Anything it throws reaches the caller through next().
+  using Transform = std::function<void(Matrix &x, Matrix &y)>;
+
+  // Produces every batch of epochs epochs over x and y, which must outlive
+  // the prefetcher.
+  BatchPrefetcher(const Matrix &x, const Matrix &y, size_t batchSize,
+                  size_t epochs, uint64_t seed = 0, size_t depth = 2,
+                  Transform transform = nullptr);
+  ~BatchPrefetcher();
+
+  BatchPrefetcher(const BatchPrefetcher &) = delete;
+  BatchPrefetcher &operator=(const BatchPrefetcher &) = delete;
+
+  // The next batch, in epoch order, or nullptr after the last one. It stays
+  // valid until the following next() call, which hands it back for reuse.
+  // If the producer threw, that exception is rethrown here once the batches
+  // gathered before it are used up.
+  const Batch *next();
+
+  size_t batches_per_epoch() const { return m_sampler.num_batches(); }
+
+private:
+  BatchSampler m_sampler;
+  size_t m_epochs;
+  Transform m_transform;
+  size_t m_epoch = 0; // where the sampler is, see fill()
+  size_t m_index = 0;
+
+  std::vector<Batch> m_slots;
+  std::deque<size_t> m_free;  // slots the producer may fill
+  std::deque<size_t> m_ready; // filled slots, in order
+  size_t m_held = SIZE_MAX;   // slot the consumer is reading
+  bool m_finished = false;
+  std::exception_ptr m_error; // thrown by the producer, for next()
+  bool m_stop = false;
+
+  std::mutex m_mutex;
+  std::condition_variable m_canProduce;
+  std::condition_variable m_canConsume;
+  std::thread m_producer;
+
+  // Gathers the next batch, moving through the epochs. False after the last.
+  bool fill(Batch &batch);
+  void produce();
+};
+} // namespace Dendrite
+
+#endif // !BATCH_PREFETCHER_H
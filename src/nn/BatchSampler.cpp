@@ -0,0 +1,89 @@
+#include "BatchSampler.hpp"
+#include <algorithm>
+#include <cassert>
+#include <random>
+
+namespace Dendrite {
+namespace {
+// Copies the given columns of src, in order, into dst (src.rows() x n). Row
+// by row, so every write is sequential and reads within a row go forward.
+// Each read is its own cache miss, so the same columns a few rows down are
+// prefetched to keep more of them in flight.
+void gather_columns(const Matrix &src, const std::vector<size_t> &cols,
+                    Matrix &dst) {
+  constexpr size_t PREFETCH_ROWS = 8;
+  dst.resize(src.rows(), cols.size());
+  const size_t n = cols.size();
+
+  for (size_t r = 0; r < src.rows(); r++) {
+    const float *in = src.data() + r * src.cols();
+    const float *ahead =
+        in + std::min(PREFETCH_ROWS, src.rows() - 1 - r) * src.cols();
+    float *out = dst.data() + r * n;
+    for (size_t j = 0; j < n; j++) {
+      __builtin_prefetch(ahead + cols[j]);
+      out[j] = in[cols[j]];
+    }
+  }
+}
+} // namespace
+
+BatchSampler::BatchSampler(const Matrix &x, const Matrix &y, size_t batchSize,
+                           uint64_t seed)
+    : m_x(x), m_y(y), m_batchSize(batchSize), m_seed(seed),
+      m_order(x.cols()) {
+  assert(x.cols() == y.cols() && batchSize > 0);
+  m_batch.reserve(batchSize);
+  start_epoch(0);
+}
+
+void BatchSampler::start_epoch(size_t epoch) {
+  std::seed_seq seq{m_seed, (uint64_t)epoch};
+  std::mt19937_64 rng(seq);
+
+  for (size_t i = 0; i < m_order.size(); i++)
+    m_order[i] = i;
+  for (size_t i = m_order.size(); i > 1; i--) {
+    // the modulo bias is below 2^-40 for any dataset that fits in memory
+    const size_t j = rng() % i;
+    std::swap(m_order[i - 1], m_order[j]);
+  }
+  m_pos = 0;
+}
+
+bool BatchSampler::next() {
+  // callers of next(x, y) never touch x()/y(), so they're sized on first use
+  if (m_batchX.capacity() == 0) {
+    m_batchX.reserve(m_x.rows() * m_batchSize);
+    m_batchY.reserve(m_y.rows() * m_batchSize);
+  }
+  return next(m_batchX, m_batchY);
+}
+
+bool BatchSampler::next(Matrix &x, Matrix &y) {
+  if (m_pos >= m_order.size())
+    return false;
+
+  const size_t end = std::min(m_pos + m_batchSize, m_order.size());
+  m_batch.assign(m_order.begin() + m_pos, m_order.begin() + end);
+  m_pos = end;
+
+  // a minibatch is a set, ascending columns just make the gather friendlier
+  std::sort(m_batch.begin(), m_batch.end());
+  gather_columns(m_x, m_batch, x);
+  gather_columns(m_y, m_batch, y);
+  return true;
+}
+
+void BatchSampler::gather(size_t b, Matrix &x, Matrix &y,
+                          std::vector<size_t> &indices) const {
+  assert(b < num_batches());
+  const size_t start = b * m_batchSize;
+  const size_t end = std::min(start + m_batchSize, m_order.size());
+  indices.assign(m_order.begin() + start, m_order.begin() + end);
+
+  std::sort(indices.begin(), indices.end());
+  gather_columns(m_x, indices, x);
+  gather_columns(m_y, indices, y);
+}
+} // namespace Dendrite
@@ -0,0 +1,64 @@
+#ifndef BATCH_SAMPLER_H
+#define BATCH_SAMPLER_H
+
+#include "math/Matrix.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace Dendrite {
+// Walks a dataset (one example per column of x and y) in minibatches, each
+// epoch in a fresh order. Only an index permutation is shuffled; next()
+// gathers a batch's columns into buffers reused across calls, so a step
+// costs O(batch) and the dataset itself is never copied or reordered.
+//
+// The order of an epoch depends only on (seed, epoch), using mt19937_64
+// and a hand-rolled Fisher-Yates, so it's the same on every platform.
+class BatchSampler {
+private:
+  const Matrix &m_x;
+  const Matrix &m_y;
+  size_t m_batchSize;
+  uint64_t m_seed;
+
+  std::vector<size_t> m_order; // this epoch's permutation
+  std::vector<size_t> m_batch; // the current batch's indices, sorted
+  size_t m_pos = 0;
+
+  Matrix m_batchX;
+  Matrix m_batchY;
+
+public:
+  // x and y must outlive the sampler
+  BatchSampler(const Matrix &x, const Matrix &y, size_t batchSize,
+               uint64_t seed = 0);
+
+  // Shuffles for the given epoch and rewinds to its first batch
+  void start_epoch(size_t epoch);
+
+  // Gathers the next batch into x()/y(), false once the epoch is done. The
+  // last batch of an epoch holds whatever is left and may be short.
+  bool next();
+
+  // next() into the caller's buffers, resized as needed
+  bool next(Matrix &x, Matrix &y);
+
+  // Batch b of the current epoch into the caller's buffers, its dataset
+  // columns into indices, without moving next()'s cursor. Only reads the
+  // sampler, so several threads can gather different batches at once.
+  void gather(size_t b, Matrix &x, Matrix &y,
+              std::vector<size_t> &indices) const;
+
+  const Matrix &x() const { return m_batchX; }
+  const Matrix &y() const { return m_batchY; }
+
+  // Dataset columns in the current batch, in the order they were gathered
+  const std::vector<size_t> &indices() const { return m_batch; }
+
+  size_t batch_size() const { return m_batchSize; }
+  size_t num_batches() const {
+    return (m_x.cols() + m_batchSize - 1) / m_batchSize;
+  }
+};
+} // namespace Dendrite
+
+#endif // !BATCH_SAMPLER_H
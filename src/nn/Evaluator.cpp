@@ -0,0 +1,129 @@
+#include "Evaluator.hpp"
+#include "core/ThreadPool.hpp"
+#include "math/CostFunction.hpp"
+#include <algorithm>
+#include <cassert>
+
+namespace Dendrite {
+namespace {
+// Row of the largest value in each of the n columns of a (rows x n, rows
+// rs floats apart), the first one on ties. Walks whole rows, so the column
+// loop is contiguous and vectorizes.
+void argmax_cols(const float *a, size_t rows, size_t n, size_t rs,
+                 float *best, uint32_t *idx) {
+  for (size_t j = 0; j < n; j++) {
+    best[j] = a[j];
+    idx[j] = 0;
+  }
+  for (size_t r = 1; r < rows; r++) {
+    const float *row = a + r * rs;
+    for (size_t j = 0; j < n; j++) {
+      const bool greater = row[j] > best[j];
+      best[j] = greater ? row[j] : best[j];
+      idx[j] = greater ? (uint32_t)r : idx[j];
+    }
+  }
+}
+
+// Outputs strictly above the true class's, per column. truthVal is scratch.
+void count_above(const float *a, size_t rows, size_t n, const uint32_t *truth,
+                 float *truthVal, uint32_t *above) {
+  for (size_t j = 0; j < n; j++) {
+    truthVal[j] = a[truth[j] * n + j];
+    above[j] = 0;
+  }
+  for (size_t r = 0; r < rows; r++) {
+    const float *row = a + r * n;
+    for (size_t j = 0; j < n; j++)
+      above[j] += row[j] > truthVal[j];
+  }
+}
+} // namespace
+
+void EvalResult::merge(const EvalResult &other) {
+  if (classes == 0) {
+    classes = other.classes;
+    confusion.assign(other.confusion.size(), 0);
+  }
+  assert(classes == other.classes && topK == other.topK);
+
+  examples += other.examples;
+  correct += other.correct;
+  topKCorrect += other.topKCorrect;
+  loss += other.loss;
+  for (size_t i = 0; i < confusion.size(); i++)
+    confusion[i] += other.confusion[i];
+}
+
+void Evaluator::evaluate_chunk(const MatrixView &x, const MatrixView &y,
+                               Shard &shard) const {
+  if (m_quantized != nullptr)
+    m_quantized->forward(x, shard.outputs);
+  const Matrix &out =
+      m_net != nullptr ? m_net->forward(x, shard.ws) : shard.outputs;
+  const size_t n = out.cols();
+  const size_t classes = out.rows();
+  assert(y.rows() == classes && y.col_stride() == 1);
+
+  shard.best.resize(n);
+  shard.predicted.resize(n);
+  shard.truth.resize(n);
+  shard.above.resize(n);
+
+  // one-hot truth, so its argmax is the class
+  argmax_cols(y.data(), classes, n, y.row_stride(), shard.best.data(),
+              shard.truth.data());
+  argmax_cols(out.data(), classes, n, n, shard.best.data(),
+              shard.predicted.data());
+  count_above(out.data(), classes, n, shard.truth.data(), shard.best.data(),
+              shard.above.data());
+
+  EvalResult &res = shard.result;
+  for (size_t j = 0; j < n; j++) {
+    res.correct += shard.predicted[j] == shard.truth[j];
+    res.topKCorrect += shard.above[j] < m_topK;
+    res.confusion[shard.truth[j] * classes + shard.predicted[j]]++;
+  }
+  res.examples += n;
+
+  const std::string &costFn = m_net != nullptr
+                                 ? m_net->cost_function()
+                                 : m_quantized->cost_function();
+  const Matrix cost = CostFunction::get_from_name(costFn).cost(out, y);
+  for (size_t i = 0; i < cost.size(); i++)
+    res.loss += cost.data()[i];
+}
+
+EvalResult Evaluator::evaluate(const MatrixView &x, const MatrixView &y) {
+  assert(x.cols() == y.cols());
+  const size_t classes = y.rows();
+  const size_t chunks = (x.cols() + m_maxBatch - 1) / m_maxBatch;
+  const size_t numShards =
+      std::max<size_t>(1, std::min(thread_pool().num_threads(), chunks));
+  if (m_shards.size() < numShards)
+    m_shards.resize(numShards);
+
+  thread_pool().parallel_for(numShards, [&](size_t s) {
+    Shard &shard = m_shards[s];
+    shard.result = EvalResult();
+    shard.result.topK = m_topK;
+    shard.result.classes = classes;
+    shard.result.confusion.assign(classes * classes, 0);
+
+    // whole chunks per shard, so every forward pass but the last is full
+    for (size_t c = s * chunks / numShards; c < (s + 1) * chunks / numShards;
+         c++) {
+      const size_t lo = c * m_maxBatch;
+      const size_t n = std::min(m_maxBatch, x.cols() - lo);
+      evaluate_chunk(x.block(0, lo, x.rows(), n), y.block(0, lo, classes, n),
+                     shard);
+    }
+  });
+
+  EvalResult total;
+  total.topK = m_topK;
+  for (size_t s = 0; s < numShards; s++)
+    total.merge(m_shards[s].result);
+  return total;
+}
+} // namespace Dendrite
@@ -0,0 +1,77 @@
+#ifndef EVALUATOR_H
+#define EVALUATOR_H
+
+#include "math/MatrixView.hpp"
+#include "nn/NeuralNetwork.hpp"
+#include "nn/QuantizedNetwork.hpp"
+#include "nn/Workspace.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace Dendrite {
+// Classification metrics over a set of examples, see Evaluator
+struct EvalResult {
+  size_t examples = 0;
+  size_t correct = 0;     // largest output is the true class
+  size_t topK = 0;        // k of topKCorrect
+  size_t topKCorrect = 0; // true class among the k largest outputs
+  double loss = 0;        // cost summed over every example
+
+  // classes x classes counts, truth-major: [truth * classes + predicted]
+  size_t classes = 0;
+  std::vector<size_t> confusion;
+
+  float accuracy() const {
+    return examples > 0 ? (float)correct / examples : 0.0f;
+  }
+  float top_k_accuracy() const {
+    return examples > 0 ? (float)topKCorrect / examples : 0.0f;
+  }
+  float mean_loss() const { return examples > 0 ? loss / examples : 0.0f; }
+
+  size_t confusion_at(size_t truth, size_t predicted) const {
+    return confusion[truth * classes + predicted];
+  }
+
+  void merge(const EvalResult &other);
+};
+
+// Scores a network on labelled data: one example per column of x, one-hot
+// truth in the matching column of y. The columns are split into one range
+// per pool thread, each run through batched forward passes on its own
+// workspace, and the partial results merged. Only reads the network, and
+// keeps its workspaces between calls. Scores a QuantizedNetwork the same
+// way.
+class Evaluator {
+private:
+  struct Shard {
+    Workspace ws;
+    Matrix outputs; // quantized forward passes only
+    EvalResult result;
+    std::vector<float> best;
+    std::vector<uint32_t> predicted;
+    std::vector<uint32_t> truth;
+    std::vector<uint32_t> above;
+  };
+
+  const NeuralNetwork *m_net = nullptr;
+  const QuantizedNetwork *m_quantized = nullptr;
+  size_t m_topK;
+  size_t m_maxBatch;
+  std::vector<Shard> m_shards;
+
+  void evaluate_chunk(const MatrixView &x, const MatrixView &y,
+                      Shard &shard) const;
+
+public:
+  Evaluator(const NeuralNetwork &net, size_t topK = 5, size_t maxBatch = 256)
+      : m_net(&net), m_topK(topK), m_maxBatch(maxBatch) {}
+  Evaluator(const QuantizedNetwork &net, size_t topK = 5,
+            size_t maxBatch = 256)
+      : m_quantized(&net), m_topK(topK), m_maxBatch(maxBatch) {}
+
+  EvalResult evaluate(const MatrixView &x, const MatrixView &y);
+};
+} // namespace Dendrite
+
+#endif // !EVALUATOR_H
@@ -1,23 +1,133 @@
 #include "Layer.hpp"
+#include "core/Pool.hpp"
+#include "math/Gemm.hpp"
+#include "math/simd/Kernels.hpp"
+#include <algorithm>
+#include <cmath>
 #include <random>
+#include <vector>
 
 namespace Dendrite {
-Layer *Layer::set_activations(const Matrix &activations) {
-  m_activations.set_data_from(activations);
-  // std::cout << "Input Activations:\n";
-  // m_activations.print();
-  return this;
+namespace {
+// freeze() compresses a layer to CSR at or below this fraction of
+// nonzeros, where the sparse kernel starts beating the dense GEMM...
+constexpr float SPARSE_MAX_DENSITY = 0.3f;
+// ...but single columns keep the packed gemv down to this one, since the
+// sparse dot products have to gather their inputs
+constexpr float SPARSE_GEMV_DENSITY = 0.1f;
+
+// write() stores CSR once at least this fraction of the weights is zero,
+// where a nonzero's value and column cost less than the dense matrix
+constexpr float SPARSE_STORAGE_ZEROS = 0.5f;
+} // namespace
+
+void HiddenLayer::forward(const MatrixView &prev, Matrix &z,
+                          Matrix &activations) const {
+  const ActivationFunction &fn = get_activation_fn();
+
+  // one column per example, buffers only grow
+  z.resize(m_weights.rows(), prev.cols());
+  activations.resize(m_weights.rows(), prev.cols());
+
+  if (!m_sparseWeights.empty() &&
+      (prev.cols() > 1 || m_packedWeights.empty())) {
+    const bool fused = fn.elementwise();
+    GemmEpilogue epilogue = {m_bias.data(), fused ? &fn : nullptr,
+                             activations.data(), activations.cols(), nullptr};
+    m_sparseWeights.multiply(prev, z.data(), z.cols(), &epilogue);
+    if (!fused) {
+      activations = z;
+      fn.activate_inplace(activations);
+    }
+    return;
+  }
+
+  if (!m_packedWeights.empty() && prev.cols() == 1) {
+    // Single sample: stream the pre-packed weights once
+    const float *x = prev.data();
+    if (prev.row_stride() != 1) {
+      thread_local PoolVector<float> gathered;
+      gathered.resize(prev.rows());
+      for (size_t i = 0; i < prev.rows(); i++)
+        gathered[i] = prev.get(i, 0);
+      x = gathered.data();
+    }
+
+    const bool fused = fn.elementwise();
+    GemmEpilogue epilogue = {m_bias.data(), fused ? &fn : nullptr,
+                             activations.data(), 1, nullptr};
+    m_packedWeights.gemv(x, z.data(), &epilogue);
+    if (!fused) {
+      activations = z;
+      fn.activate_inplace(activations);
+    }
+    return;
+  }
+
+  if (!fn.elementwise()) {
+    matmul_into(z, m_weights, prev);
+    for (size_t i = 0; i < z.rows(); i++) {
+      float *row = z.data() + i * z.cols();
+      kernels().add_scalar(row, m_bias.data()[i], row, z.cols());
+    }
+    activations = z;
+    fn.activate_inplace(activations);
+    return;
+  }
+
+  // z = W * prev + b and activations = fn(z), written in place per tile
+  GemmEpilogue epilogue = {m_bias.data(), &fn, activations.data(),
+                           activations.cols(), nullptr};
+  gemm_bias_act(m_weights.rows(), prev.cols(), m_weights.cols(),
+                m_weights.data(), m_weights.cols(), 1, prev.data(),
+                prev.row_stride(), prev.col_stride(), z.data(), z.cols(),
+                epilogue);
 }
 
-Layer *InputLayer::set_inputs(const Matrix &inputs) {
-  assert(inputs.cols() == 1 && inputs.rows() == m_neurons);
-  return set_activations(inputs);
+void HiddenLayer::freeze() {
+  unfreeze();
+  const float density = 1.0f - zero_fraction(m_weights);
+  if (density <= SPARSE_MAX_DENSITY)
+    m_sparseWeights.compress(m_weights);
+  if (density > SPARSE_GEMV_DENSITY)
+    m_packedWeights.pack(m_weights);
 }
 
-Matrix &HiddenLayer::calc_activations() {
-  m_z = (m_weights * m_prevLayer->get_activations()).add_inplace(m_bias);
-  m_activations = ActivationFunction::get_from_name(m_fn).activate(m_z);
-  return m_activations;
+void HiddenLayer::prune(float sparsity) {
+  assert(sparsity >= 0.0f && sparsity < 1.0f);
+  m_sparsity = sparsity;
+  const size_t n = m_weights.size();
+  const size_t target = (size_t)(sparsity * n);
+  if (target == 0)
+    return;
+
+  // the target-th smallest magnitude: everything below it goes, then as
+  // many ties as it takes
+  float *w = m_weights.data();
+  std::vector<float> magnitudes(n);
+  for (size_t i = 0; i < n; i++)
+    magnitudes[i] = std::fabs(w[i]);
+  std::nth_element(magnitudes.begin(), magnitudes.begin() + target - 1,
+                   magnitudes.end());
+  const float threshold = magnitudes[target - 1];
+
+  size_t zeroed = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (std::fabs(w[i]) < threshold) {
+      w[i] = 0.0f;
+      zeroed++;
+    }
+  }
+  for (size_t i = 0; i < n && zeroed < target; i++) {
+    if (std::fabs(w[i]) == threshold) {
+      w[i] = 0.0f;
+      zeroed++;
+    }
+  }
+}
+
+bool HiddenLayer::sparse_storage() const {
+  return zero_fraction(m_weights) >= SPARSE_STORAGE_ZEROS;
 }
 
 void HiddenLayer::rand_init() {
@@ -29,15 +139,14 @@ void HiddenLayer::rand_init() {
     m_bias.set(i, 0, dist(generator));
   }
 
-  const Matrix &prevActivations = m_prevLayer->get_activations();
-  for (size_t i = 0; i < m_activations.rows(); i++) {
-    for (size_t j = 0; j < prevActivations.rows(); j++) {
+  for (size_t i = 0; i < m_weights.rows(); i++) {
+    for (size_t j = 0; j < m_weights.cols(); j++) {
       m_weights.set(i, j, dist(generator));
     }
   }
 }
 
-void HiddenLayer::write(std::basic_ofstream<char> &stream) {
+void HiddenLayer::write(std::basic_ofstream<char> &stream, bool tagged) {
   uint64_t numNeurons = num_neurons();
   stream.write(reinterpret_cast<const char *>(&numNeurons), // Number of neurons
                sizeof(numNeurons));
@@ -54,19 +163,49 @@ void HiddenLayer::write(std::basic_ofstream<char> &stream) {
   stream.write(reinterpret_cast<const char *>(&weightCols),
                sizeof(weightCols)); // Input layer
 
-  for (size_t i = 0; i < weightRows * weightCols; i++) {
-    float w = m_weights.get_data()[i];
-    stream.write(reinterpret_cast<const char *>(&w), sizeof(w));
-  }
+  const uint8_t sparse = tagged && sparse_storage();
+  if (tagged)
+    stream.write(reinterpret_cast<const char *>(&sparse), sizeof(sparse));
+
+  if (sparse) {
+    // CSR: nonzeros per row, then each nonzero's column (16 bits when they
+    // fit) and its value
+    const bool narrow = weightCols <= UINT16_MAX + 1;
+    std::vector<uint32_t> rowCounts(weightRows);
+    std::vector<uint32_t> colIndex;
+    std::vector<float> values;
+    for (size_t i = 0; i < weightRows; i++) {
+      for (size_t j = 0; j < weightCols; j++) {
+        if (m_weights.get(i, j) == 0.0f)
+          continue;
+        rowCounts[i]++;
+        colIndex.push_back(j);
+        values.push_back(m_weights.get(i, j));
+      }
+    }
 
-  for (size_t i = 0; i < numNeurons; i++) {
-    float b = m_bias.get_data()[i];
-    stream.write(reinterpret_cast<const char *>(&b), sizeof(b));
+    stream.write(reinterpret_cast<const char *>(rowCounts.data()),
+                 rowCounts.size() * sizeof(uint32_t));
+    if (narrow) {
+      std::vector<uint16_t> cols(colIndex.begin(), colIndex.end());
+      stream.write(reinterpret_cast<const char *>(cols.data()),
+                   cols.size() * sizeof(uint16_t));
+    } else {
+      stream.write(reinterpret_cast<const char *>(colIndex.data()),
+                   colIndex.size() * sizeof(uint32_t));
+    }
+    stream.write(reinterpret_cast<const char *>(values.data()),
+                 values.size() * sizeof(float));
+  } else {
+    stream.write(reinterpret_cast<const char *>(m_weights.data()),
+                 m_weights.size() * sizeof(float));
   }
+  stream.write(reinterpret_cast<const char *>(m_bias.data()),
+               m_bias.size() * sizeof(float));
 }
 
 HiddenLayer HiddenLayer::load(std::basic_ifstream<char> &stream,
-                              std::shared_ptr<Layer> prevLayer) {
+                              std::shared_ptr<Layer> prevLayer, bool tagged) {
   uint64_t numNeurons;
   stream.read(reinterpret_cast<char *>(&numNeurons), sizeof(numNeurons));
 
@@ -83,28 +222,59 @@ HiddenLayer HiddenLayer::load(std::basic_ifstream<char> &stream,
   Matrix weights = Matrix(weightRows, weightCols);
   Matrix biases = Matrix(numNeurons, 1);
 
-  for (size_t i = 0; i < weightRows * weightCols; i++) {
-    float w;
-    stream.read(reinterpret_cast<char *>(&w), sizeof(w));
-    weights.set_data(i, w);
-  }
-  for (size_t i = 0; i < numNeurons; i++) {
-    float b;
-    stream.read(reinterpret_cast<char *>(&b), sizeof(b));
-    biases.set_data(i, b);
+  uint8_t sparse = 0;
+  if (tagged)
+    stream.read(reinterpret_cast<char *>(&sparse), sizeof(sparse));
+
+  if (sparse) {
+    // see write(), the zeros come from Matrix's zeroed storage
+    std::vector<uint32_t> rowCounts(weightRows);
+    stream.read(reinterpret_cast<char *>(rowCounts.data()),
+                rowCounts.size() * sizeof(uint32_t));
+    size_t nonzeros = 0;
+    for (uint32_t count : rowCounts)
+      nonzeros += count;
+
+    std::vector<uint32_t> colIndex(nonzeros);
+    if (weightCols <= UINT16_MAX + 1) {
+      std::vector<uint16_t> cols(nonzeros);
+      stream.read(reinterpret_cast<char *>(cols.data()),
+                  cols.size() * sizeof(uint16_t));
+      std::copy(cols.begin(), cols.end(), colIndex.begin());
+    } else {
+      stream.read(reinterpret_cast<char *>(colIndex.data()),
+                  colIndex.size() * sizeof(uint32_t));
+    }
+    std::vector<float> values(nonzeros);
+    stream.read(reinterpret_cast<char *>(values.data()),
+                values.size() * sizeof(float));
+
+    size_t i = 0;
+    for (size_t r = 0; r < weightRows; r++) {
+      for (uint32_t n = 0; n < rowCounts[r]; n++, i++)
+        weights.set(r, colIndex[i], values[i]);
+    }
+  } else {
+    stream.read(reinterpret_cast<char *>(weights.data()),
+                weights.size() * sizeof(float));
   }
+  stream.read(reinterpret_cast<char *>(biases.data()),
+              biases.size() * sizeof(float));
 
   HiddenLayer out = HiddenLayer(numNeurons, prevLayer, activationFn);
-  out.m_weights = weights;
-  out.m_bias = biases;
+  out.m_weights = std::move(weights);
+  out.m_bias = std::move(biases);
+  // a layer saved as CSR was pruned, and stays pruned if trained further
+  if (sparse)
+    out.m_sparsity = zero_fraction(out.m_weights);
 
   return out;
 }
 
 OutputLayer OutputLayer::load(std::basic_ifstream<char> &stream,
-                              std::shared_ptr<Layer> prevLayer) {
-  HiddenLayer layer = HiddenLayer::load(stream, prevLayer);
-  return *static_cast<OutputLayer *>(&layer);
+                              std::shared_ptr<Layer> prevLayer, bool tagged) {
+  HiddenLayer layer = HiddenLayer::load(stream, prevLayer, tagged);
+  return std::move(*static_cast<OutputLayer *>(&layer));
 }
 
 } // namespace Dendrite
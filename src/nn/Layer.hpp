@@ -3,25 +3,24 @@
 
 #include "math/ActivationFunction.hpp"
 #include "math/Matrix.hpp"
+#include "math/PackedMatrix.hpp"
+#include "math/SparseMatrix.hpp"
 #include <cassert>
 #include <cstdlib>
 #include <fstream>
 #include <memory>
 
 namespace Dendrite {
+// Layers hold parameters only. Everything a forward or backward pass writes
+// lives in a Workspace (see Workspace.hpp), so one network can serve any
+// number of threads at once.
 class Layer {
 protected:
   size_t m_neurons;
-  Matrix m_activations; // Single column, Rows are activations of this layer's
-                        // perceptrons
-public:
-  Layer(size_t numNeurons) : m_activations(numNeurons, 1) {
-    m_neurons = numNeurons;
-  }
 
-  Layer *set_activations(const Matrix &activations);
+public:
+  Layer(size_t numNeurons) : m_neurons(numNeurons) {}
 
-  const Matrix &get_activations() const { return m_activations; }
   int num_neurons() const { return m_neurons; }
 };
 
@@ -29,50 +28,81 @@ class InputLayer : public Layer {
 public:
   InputLayer(size_t numInputs) : Layer(numInputs) {}
 
-  Layer *set_inputs(const Matrix &inputs);
-
   int num_inputs() const { return m_neurons; }
 };
 
 class HiddenLayer : public Layer {
 protected:
-  Matrix m_z;
   std::string m_fn;
+  // set while frozen, see freeze()
+  PackedMatrix m_packedWeights;
+  SparseMatrix m_sparseWeights;
+  float m_sparsity = 0.0f;
 
 public:
   std::shared_ptr<Layer> m_prevLayer;
+  // Once in a network, both borrow from its flat parameter buffer, see
+  // NeuralNetwork::bind_parameters()
   Matrix m_weights; // This layer's neurons x Previous layer's neurones
   Matrix m_bias;
 
   HiddenLayer(const HiddenLayer &other)
-      : Layer(other.m_weights.rows()),
-        m_z(other.m_activations.rows(), other.m_activations.cols()),
-        m_fn(other.m_fn), m_weights(other.m_weights), m_bias(other.m_bias) {
+      : Layer(other.m_weights.rows()), m_fn(other.m_fn),
+        m_sparsity(other.m_sparsity), m_weights(other.m_weights),
+        m_bias(other.m_bias) {
     m_prevLayer = other.m_prevLayer;
   }
 
+  HiddenLayer(HiddenLayer &&other) = default;
+
   HiddenLayer(size_t numNeurons, std::shared_ptr<Layer> prevLayer,
               std::string fn)
-      : Layer(numNeurons), m_z(m_activations.rows(), m_activations.cols()),
-        m_fn(fn), m_weights(numNeurons, prevLayer->get_activations().rows()),
+      : Layer(numNeurons), m_fn(fn),
+        m_weights(numNeurons, prevLayer->num_neurons()),
         m_bias(numNeurons, 1) {
     m_prevLayer = prevLayer;
   }
 
-  const Matrix &get_z() const { return m_z; }
   const ActivationFunction &get_activation_fn() const {
     return ActivationFunction::get_from_name(m_fn);
   }
   const std::string &get_activation_fn_name() const { return m_fn; }
 
-  Matrix &calc_activations();
+  // z = W * prev + b, activations = fn(z), one column per example. Only
+  // reads the layer, so threads can share it with their own z/activations.
+  void forward(const MatrixView &prev, Matrix &z, Matrix &activations) const;
 
   void rand_init();
 
-  void write(std::basic_ofstream<char> &stream);
+  // Packs m_weights for single-column forward passes and, when few enough
+  // of them are nonzero, compresses them to CSR for batched ones (and
+  // single columns too, once sparse enough to skip packing). Any change to
+  // m_weights after this needs unfreeze() (or another freeze()) first.
+  void freeze();
+  void unfreeze() {
+    m_packedWeights.clear();
+    m_sparseWeights.clear();
+  }
+  bool frozen() const {
+    return !m_packedWeights.empty() || !m_sparseWeights.empty();
+  }
+
+  // Zeroes the smallest-magnitude weights, sparsity of them in all, and
+  // records the fraction so training keeps them at zero (see
+  // NeuralNetwork::prune()). 0 makes the layer dense again.
+  void prune(float sparsity);
+  float sparsity() const { return m_sparsity; }
+
+  // Whether write() stores the weights as CSR, once enough are zero
+  bool sparse_storage() const;
+
+  // Tagged streams mark each layer's weights as dense or CSR, see
+  // NeuralNetwork::save(). Untagged ones are always dense.
+  void write(std::basic_ofstream<char> &stream, bool tagged = false);
 
   static HiddenLayer load(std::basic_ifstream<char> &stream,
-                          std::shared_ptr<Layer> prevLayer);
+                          std::shared_ptr<Layer> prevLayer,
+                          bool tagged = false);
 
   std::shared_ptr<Layer> get_prev_layer() { return m_prevLayer; }
 };
@@ -83,11 +113,9 @@ public:
               const std::string &fn)
       : HiddenLayer(numOutputs, prevLayer, fn) {}
 
-  const Matrix &calc_outputs() { return calc_activations(); }
-  const Matrix &get_outputs() const { return m_activations; }
-
   static OutputLayer load(std::basic_ifstream<char> &stream,
-                          std::shared_ptr<Layer> prevLayer);
+                          std::shared_ptr<Layer> prevLayer,
+                          bool tagged = false);
 };
 } // namespace Dendrite
 
@@ -1,8 +1,63 @@
 #include "NeuralNetwork.hpp"
+#include "core/ThreadPool.hpp"
+#include "math/simd/Kernels.hpp"
+#include "nn/BatchPrefetcher.hpp"
+#include "nn/BatchSampler.hpp"
+#include "nn/Evaluator.hpp"
+#include <atomic>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <thread>
 namespace Dendrite {
+namespace {
+// Fewer columns per shard than this and a shard's GEMMs degrade into
+// matrix-vector work, so small batches are split less.
+constexpr size_t MIN_SHARD_COLS = 8;
+
+// Floats per gradient reduction task, 64 KiB
+constexpr size_t REDUCE_CHUNK = 16384;
+
+// Each matrix in the flat parameter buffer starts on a cache line
+constexpr size_t PARAM_ALIGN = POOL_ALIGNMENT / sizeof(float);
+
+size_t param_padded(size_t n) {
+  return (n + PARAM_ALIGN - 1) / PARAM_ALIGN * PARAM_ALIGN;
+}
+
+// delta *= fn'(z), with fn' written over z, which backward is done with
+void mul_activation_deriv(const ActivationFunction &fn, Matrix &z,
+                          Matrix &delta) {
+  if (fn.elementwise()) {
+    fn.deriv_span(z.data(), z.data(), z.size());
+  } else {
+    z = fn.deriv(z);
+  }
+  delta.elem_multiply_inplace(z);
+}
+
+// W -= step * dW and b -= step * db, one row of W at a time. With cols set,
+// only those columns of W are touched.
+void sgd_update(HiddenLayer &layer, const LayerWorkspace &lw, float step,
+                const std::vector<size_t> *cols) {
+  Matrix &w = layer.m_weights;
+  const Matrix &dw = lw.weightGradient;
+
+  for (size_t i = 0; i < w.rows(); i++) {
+    float *row = w.data() + i * w.cols();
+    const float *grad = dw.data() + i * dw.cols();
+    if (cols == nullptr) {
+      kernels().axpy(-step, grad, row, w.cols());
+    } else {
+      for (size_t j : *cols)
+        row[j] -= step * grad[j];
+    }
+  }
+  kernels().axpy(-step, lw.biasGradient.data(), layer.m_bias.data(),
+                 layer.m_bias.size());
+}
+} // namespace
+
 void NeuralNetwork::set_input_layer(int numInputs) {
   this->m_inputLayer = std::make_shared<InputLayer>(numInputs);
 }
@@ -36,15 +91,186 @@ void NeuralNetwork::init() {
     m_hiddenLayers[i]->rand_init();
   }
   m_outputLayer->rand_init();
+  bind_parameters();
+}
+
+void NeuralNetwork::bind_parameters() {
+  assert(m_inputLayer && m_outputLayer);
+  const size_t numLayers = m_hiddenLayers.size() + 1;
+
+  m_paramOffsets.assign(1, 0);
+  for (size_t i = 0; i < numLayers; i++) {
+    const HiddenLayer &l = layer(i);
+    m_paramOffsets.push_back(m_paramOffsets.back() +
+                             param_padded(l.m_weights.size()));
+    m_paramOffsets.push_back(m_paramOffsets.back() +
+                             param_padded(l.m_bias.size()));
+  }
+
+  // copy into the new buffer before any layer lets go of its old storage
+  Matrix params(1, m_paramOffsets.back());
+  for (size_t i = 0; i < numLayers; i++) {
+    const HiddenLayer &l = layer(i);
+    std::copy(l.m_weights.data(), l.m_weights.data() + l.m_weights.size(),
+              params.data() + m_paramOffsets[2 * i]);
+    std::copy(l.m_bias.data(), l.m_bias.data() + l.m_bias.size(),
+              params.data() + m_paramOffsets[2 * i + 1]);
+  }
+  m_parameters = std::move(params);
+
+  for (size_t i = 0; i < numLayers; i++) {
+    HiddenLayer &l = mutable_layer(i);
+    l.m_weights.borrow(m_parameters.data() + m_paramOffsets[2 * i],
+                       l.m_weights.rows(), l.m_weights.cols());
+    l.m_bias.borrow(m_parameters.data() + m_paramOffsets[2 * i + 1],
+                    l.m_bias.rows(), l.m_bias.cols());
+  }
+  m_optimizerState = OptimizerState();
+  build_prune_mask();
+}
+
+bool NeuralNetwork::parameters_bound() const {
+  const size_t numLayers = m_hiddenLayers.size() + 1;
+  if (!m_outputLayer || m_paramOffsets.size() != 2 * numLayers + 1)
+    return false;
+
+  for (size_t i = 0; i < numLayers; i++) {
+    if (layer(i).m_weights.data() !=
+        m_parameters.data() + m_paramOffsets[2 * i])
+      return false;
+  }
+  return true;
+}
+
+void NeuralNetwork::build_prune_mask() {
+  const size_t numLayers = m_hiddenLayers.size() + 1;
+  bool pruned = false;
+  for (size_t i = 0; i < numLayers; i++)
+    pruned |= layer(i).sparsity() > 0.0f;
+  if (!pruned) {
+    PoolVector<float>().swap(m_pruneMask);
+    return;
+  }
+
+  m_pruneMask.assign(m_parameters.size(), 1.0f);
+  for (size_t i = 0; i < numLayers; i++) {
+    const HiddenLayer &l = layer(i);
+    if (l.sparsity() == 0.0f)
+      continue;
+    const float *w = l.m_weights.data();
+    float *mask = m_pruneMask.data() + m_paramOffsets[2 * i];
+    for (size_t j = 0; j < l.m_weights.size(); j++)
+      mask[j] = w[j] == 0.0f ? 0.0f : 1.0f;
+  }
+}
+
+void NeuralNetwork::apply_prune_mask() {
+  if (m_pruneMask.empty())
+    return;
+  kernels().mul(m_parameters.data(), m_pruneMask.data(), m_parameters.data(),
+                m_parameters.size());
+}
+
+void NeuralNetwork::prune(float sparsity) {
+  assert(m_outputLayer);
+  const bool wasFrozen = frozen();
+  if (wasFrozen)
+    unfreeze();
+  if (!parameters_bound())
+    bind_parameters();
+
+  for (size_t i = 0; i < m_hiddenLayers.size(); i++) {
+    m_hiddenLayers[i]->prune(sparsity);
+  }
+  build_prune_mask();
+  if (wasFrozen)
+    freeze();
+}
+
+void NeuralNetwork::bind_gradients(Workspace &ws) const {
+  assert(parameters_bound());
+  if (ws.gradients.same_shape(m_parameters))
+    return;
+
+  // zeroed, the padding between matrices stays that way
+  ws.gradients = Matrix(1, m_parameters.size());
+  ws.layers.resize(m_hiddenLayers.size() + 1);
+  for (size_t i = 0; i < ws.layers.size(); i++) {
+    const HiddenLayer &l = layer(i);
+    ws.layers[i].weightGradient.borrow(
+        ws.gradients.data() + m_paramOffsets[2 * i], l.m_weights.rows(),
+        l.m_weights.cols());
+    ws.layers[i].biasGradient.borrow(
+        ws.gradients.data() + m_paramOffsets[2 * i + 1], l.m_bias.rows(),
+        l.m_bias.cols());
+  }
+}
+
+const Matrix &NeuralNetwork::forward(const MatrixView &inputs) {
+  return forward(inputs, m_inferenceWorkspace);
+}
+
+void NeuralNetwork::forward_batch(const MatrixView &inputs, Matrix &outputs,
+                                  size_t maxBatch) {
+  forward_batch(inputs, outputs, m_inferenceWorkspace, maxBatch);
+}
+
+void NeuralNetwork::forward_batch(const MatrixView &inputs, Matrix &outputs,
+                                  Workspace &ws, size_t maxBatch) const {
+  assert(m_inputLayer && m_outputLayer && maxBatch > 0);
+  assert(inputs.rows() == (size_t)m_inputLayer->num_inputs());
+  outputs.resize(m_outputLayer->num_neurons(), inputs.cols());
+
+  for (size_t j = 0; j < inputs.cols(); j += maxBatch) {
+    const size_t n = std::min(maxBatch, inputs.cols() - j);
+    const Matrix &out = forward(inputs.block(0, j, inputs.rows(), n), ws);
+
+    for (size_t r = 0; r < out.rows(); r++) {
+      const float *src = out.data() + r * n;
+      std::copy(src, src + n, outputs.data() + r * outputs.cols() + j);
+    }
+  }
+}
+
+const Matrix &NeuralNetwork::forward(const MatrixView &inputs,
+                                     Workspace &ws) const {
+  assert(m_inputLayer && m_outputLayer);
+  assert(inputs.rows() == (size_t)m_inputLayer->num_inputs());
+  const size_t numLayers = m_hiddenLayers.size() + 1;
+  ws.layers.resize(numLayers);
+  ws.inputs = inputs;
+
+  for (size_t i = 0; i < numLayers; i++) {
+    const MatrixView prev =
+        i == 0 ? inputs : ws.layers[i - 1].activations.view();
+    layer(i).forward(prev, ws.layers[i].z, ws.layers[i].activations);
+  }
+  return ws.layers.back().activations;
+}
+
+Matrix NeuralNetwork::forward_batch(const MatrixView &inputs,
+                                    size_t maxBatch) {
+  Matrix outputs;
+  forward_batch(inputs, outputs, maxBatch);
+  return outputs;
 }
 
-Matrix NeuralNetwork::forward(const Matrix &inputs) {
-  m_inputLayer->set_inputs(inputs);
+void NeuralNetwork::freeze() {
   for (size_t i = 0; i < m_hiddenLayers.size(); i++) {
-    // std::cout << "=====Calculating Activations For Layer " << i << "\n";
-    m_hiddenLayers[i]->calc_activations();
+    m_hiddenLayers[i]->freeze();
   }
-  return m_outputLayer->calc_outputs();
+  m_outputLayer->freeze();
+}
+
+void NeuralNetwork::unfreeze() {
+  for (size_t i = 0; i < m_hiddenLayers.size(); i++) {
+    m_hiddenLayers[i]->unfreeze();
+  }
+  m_outputLayer->unfreeze();
+}
+
+bool NeuralNetwork::frozen() const {
+  return m_outputLayer && m_outputLayer->frozen();
 }
 
 void NeuralNetwork::update_batch(
@@ -55,53 +281,136 @@ void NeuralNetwork::update_batch(
   assert(m_inputLayer);
   assert(m_outputLayer);
 
-  std::vector<Matrix> layerWeightGradients;
-  std::vector<Matrix> layerBiasGradients;
+  // the packed copies would go stale
+  if (frozen())
+    unfreeze();
 
-  for (size_t i = 0; i < m_hiddenLayers.size(); i++) {
-    layerBiasGradients.emplace_back(
-        Matrix::with_same_shape(m_hiddenLayers[i]->m_bias));
-    layerWeightGradients.emplace_back(
-        Matrix::with_same_shape(m_hiddenLayers[i]->m_weights));
-  }
-  layerBiasGradients.emplace_back(
-      Matrix::with_same_shape(m_outputLayer->m_bias));
-  layerWeightGradients.emplace_back(
-      Matrix::with_same_shape(m_outputLayer->m_weights));
+  assert(start < end && end <= xs.cols());
+
+  const size_t n = end - start;
+  const size_t shards = num_shards(n);
+  plan_training(n);
 
-  // calculate the gradients for each weight bias matrix per layer
-  for (size_t i = start; i < end; i++) {
-    const auto [dw, db] = backprop(xs, ys, i); // weights, biases
+  if (m_precision == Precision::BF16_WEIGHTS) {
+    m_parametersBf16.resize(m_parameters.size());
+    kernels().to_bf16(m_parameters.data(), m_parametersBf16.data(),
+                      m_parameters.size());
+  }
 
-    for (size_t j = 0; j < layerWeightGradients.size(); j++) {
-      layerWeightGradients[j] += dw[j];
-      layerBiasGradients[j] += db[j];
+  thread_pool().parallel_for(shards, [&](size_t s) {
+    const size_t lo = start + s * n / shards;
+    const size_t hi = start + (s + 1) * n / shards;
+    const MatrixView x = xs.block(0, lo, xs.rows(), hi - lo);
+    const MatrixView y = ys.block(0, lo, ys.rows(), hi - lo);
+    if (m_precision == Precision::FP32) {
+      forward(x, m_workspaces[s]);
+      backward(y, m_workspaces[s]);
+    } else {
+      forward_bf16(x, m_workspaces[s]);
+      backward_bf16(y, m_workspaces[s]);
     }
+  });
+  reduce_gradients(shards);
+
+  // one pass over every parameter
+  Optimizer::get_from_name(m_optimizer)
+      .update(m_parameters, m_workspaces[0].gradients, m_optimizerState,
+              learningRate, 1.0f / n);
+  apply_prune_mask();
+}
+
+size_t NeuralNetwork::plan_workspace(Workspace &ws, size_t batchSize,
+                                     bool training) const {
+  assert(m_inputLayer && m_outputLayer);
+  const size_t numLayers = m_hiddenLayers.size() + 1;
+  ws.layers.resize(numLayers);
+
+  const bool bf16 = training && m_precision != Precision::FP32;
+  size_t widest = 0;
+  for (size_t i = 0; i < numLayers; i++) {
+    const Matrix &w = layer(i).m_weights;
+    LayerWorkspace &lw = ws.layers[i];
+    lw.z.reserve(w.rows() * batchSize);
+    if (bf16 && i + 1 < numLayers)
+      lw.activationsBf16.reserve(w.rows() * batchSize);
+    else
+      lw.activations.reserve(w.rows() * batchSize);
+    widest = std::max(widest, w.rows());
+  }
+  if (training) {
+    bind_gradients(ws);
+    ws.deltas[0].reserve(widest * batchSize);
+    if (bf16)
+      ws.deltaBf16.reserve(widest * batchSize);
+    else
+      ws.deltas[1].reserve(widest * batchSize);
   }
+  return ws.bytes();
+}
 
-  size_t n = end - start;
+size_t NeuralNetwork::plan_training(size_t batchSize) {
+  if (!parameters_bound())
+    bind_parameters();
 
-  // apply the gradients to each weight/bias matrix per layer
-  for (size_t i = 0; i < m_hiddenLayers.size(); i++) {
-    m_hiddenLayers[i]->m_weights -=
-        (layerWeightGradients[i] * (learningRate / n));
-    m_hiddenLayers[i]->m_bias -= (layerBiasGradients[i] * (learningRate / n));
+  const size_t shards = num_shards(batchSize);
+  if (m_workspaces.size() < shards)
+    m_workspaces.resize(shards);
+
+  size_t bytes = 0;
+  for (size_t s = 0; s < shards; s++) {
+    bytes += plan_workspace(m_workspaces[s],
+                            (batchSize + shards - 1) / shards);
+  }
+  return bytes;
+}
+
+void NeuralNetwork::set_optimizer(const std::string &name) {
+  assert(Optimizer::s_optimizers.count(name) > 0);
+  m_optimizer = name;
+  m_optimizerState = OptimizerState();
+}
+
+void NeuralNetwork::set_precision(Precision precision) {
+  m_precision = precision;
+  if (precision != Precision::BF16_WEIGHTS)
+    PoolVector<BFloat16>().swap(m_parametersBf16);
+}
+
+size_t NeuralNetwork::train_threads() const {
+  const size_t poolThreads = thread_pool().num_threads();
+  return m_trainThreads > 0 ? std::min(m_trainThreads, poolThreads)
+                            : poolThreads;
+}
+
+size_t NeuralNetwork::num_shards(size_t batchSize) const {
+  return std::max<size_t>(
+      1, std::min(train_threads(), batchSize / MIN_SHARD_COLS));
+}
+
+void NeuralNetwork::reduce_gradients(size_t shards) {
+  const size_t n = m_parameters.size();
+  const size_t chunks = (n + REDUCE_CHUNK - 1) / REDUCE_CHUNK;
+
+  // round r adds shard s + 2^r onto shard s, for every s that's a multiple
+  // of 2^(r+1); one task per (pair, chunk of the flat gradients)
+  for (size_t stride = 1; stride < shards; stride *= 2) {
+    const size_t pairs = (shards - stride + 2 * stride - 1) / (2 * stride);
+    thread_pool().parallel_for(pairs * chunks, [&](size_t t) {
+      const size_t dst = (t / chunks) * 2 * stride;
+      const size_t lo = (t % chunks) * REDUCE_CHUNK;
+      const size_t len = std::min(REDUCE_CHUNK, n - lo);
+
+      float *to = m_workspaces[dst].gradients.data() + lo;
+      const float *from = m_workspaces[dst + stride].gradients.data() + lo;
+      kernels().add(to, from, to, len);
+    });
   }
-  m_outputLayer->m_weights -=
-      (layerWeightGradients[layerWeightGradients.size() - 1] *
-       (learningRate / n));
-  m_outputLayer->m_bias -=
-      (layerBiasGradients[layerWeightGradients.size() - 1] *
-       (learningRate / n));
 }
 
 std::tuple<std::vector<Matrix>, std::vector<Matrix>>
 NeuralNetwork::backprop(const Matrix &xs, const Matrix &ys,
                         size_t exampleIndex) { // Columns in x and y should be
                                                // inputs/output vectors
-  assert(xs.cols() == ys.cols());
-  assert(exampleIndex >= 0 && exampleIndex < xs.cols());
-
   std::vector<Matrix> weightGradients;
   std::vector<Matrix> biasGradients;
 
@@ -115,91 +424,279 @@ NeuralNetwork::backprop(const Matrix &xs, const Matrix &ys,
   weightGradients.emplace_back(
       Matrix::with_same_shape(m_outputLayer->m_weights));
 
-  Matrix x = xs.get_col(exampleIndex);
-  Matrix y = ys.get_col(exampleIndex);
+  backprop(xs, ys, exampleIndex, weightGradients, biasGradients);
 
-  Matrix out = forward(x);
+  return std::tuple<std::vector<Matrix>, std::vector<Matrix>>(
+      std::move(weightGradients), std::move(biasGradients));
+}
 
-  Matrix delta =
-      CostFunction::get_from_name(m_costFunction)
-          .deriv(out, y)
-          .elem_multiply_inplace(
-              m_outputLayer->get_activation_fn().deriv(m_outputLayer->get_z()));
+void NeuralNetwork::backprop(const Matrix &xs, const Matrix &ys,
+                             size_t exampleIndex,
+                             std::vector<Matrix> &weightGradients,
+                             std::vector<Matrix> &biasGradients) {
+  assert(xs.cols() == ys.cols());
+  assert(exampleIndex < xs.cols());
+  assert(weightGradients.size() == m_hiddenLayers.size() + 1);
+  assert(biasGradients.size() == m_hiddenLayers.size() + 1);
+
+  MatrixView x = xs.col(exampleIndex);
+  MatrixView y = ys.col(exampleIndex);
+
+  if (!parameters_bound())
+    bind_parameters();
+  if (m_workspaces.empty())
+    m_workspaces.resize(1);
+  Workspace &ws = m_workspaces[0];
+  forward(x, ws);
+  backward(y, ws);
+
+  for (size_t i = 0; i < ws.layers.size(); i++) {
+    weightGradients[i] += ws.layers[i].weightGradient;
+    biasGradients[i] += ws.layers[i].biasGradient;
+  }
+}
 
-  biasGradients.back() = delta;
-  weightGradients.back() =
-      delta.dot_multiply(m_hiddenLayers.back()->get_activations().transpose());
+void NeuralNetwork::backward(const MatrixView &ys, Workspace &ws) const {
+  const size_t numLayers = m_hiddenLayers.size() + 1;
+  assert(ws.layers.size() == numLayers);
+  const Matrix &out = ws.layers.back().activations;
+  assert(ys.rows() == out.rows() && ys.cols() == out.cols());
+  bind_gradients(ws);
 
-  for (int i = (m_hiddenLayers.size() - 1); i >= 0; i--) {
-    Matrix z = m_hiddenLayers[i]->get_z();
-    Matrix activationDeriv = m_hiddenLayers[i]->get_activation_fn().deriv(z);
+  for (int i = numLayers - 1; i >= 0; i--) {
+    const HiddenLayer &l = layer(i);
+    LayerWorkspace &lw = ws.layers[i];
+    Matrix &delta = ws.deltas[i % 2];
 
-    if (i == m_hiddenLayers.size() - 1) {
-      delta = m_outputLayer->m_weights.transpose()
-                  .dot_multiply(delta)
-                  .elem_multiply_inplace(activationDeriv);
+    if (i == (int)numLayers - 1) {
+      CostFunction::get_from_name(m_costFunction).deriv_into(out, ys, delta);
     } else {
-      delta = m_hiddenLayers[i + 1]
-                  ->m_weights.transpose()
-                  .dot_multiply(delta)
-                  .elem_multiply_inplace(activationDeriv);
+      // W_next^T * delta, reading W_next in place
+      const Matrix &nextWeights = layer(i + 1).m_weights;
+      const Matrix &nextDelta = ws.deltas[(i + 1) % 2];
+      delta.resize(nextWeights.cols(), nextDelta.cols());
+      matmul_into(delta, nextWeights.view().transpose(), nextDelta);
     }
+    mul_activation_deriv(l.get_activation_fn(), lw.z, delta);
 
-    biasGradients[i] = delta;
-    if (i > 0) {
-      weightGradients[i] = delta.dot_multiply(
-          m_hiddenLayers[i - 1]->get_activations().transpose());
+    // dW = delta * prev^T and db = delta * 1, both summed over the batch
+    const MatrixView prev =
+        i == 0 ? ws.inputs : ws.layers[i - 1].activations.view();
+    matmul_into(lw.weightGradient, delta, prev.transpose());
+    row_sums_into(lw.biasGradient, delta);
+  }
+}
+
+GemmOperand NeuralNetwork::weights_operand(size_t i, bool transposed) const {
+  const Matrix &w = layer(i).m_weights;
+  const size_t rs = transposed ? 1 : w.cols();
+  const size_t cs = transposed ? w.cols() : 1;
+  if (m_precision == Precision::BF16_WEIGHTS)
+    return {nullptr, m_parametersBf16.data() + m_paramOffsets[2 * i], rs, cs};
+  return {w.data(), nullptr, rs, cs};
+}
+
+void NeuralNetwork::forward_bf16(const MatrixView &inputs,
+                                 Workspace &ws) const {
+  assert(inputs.rows() == (size_t)m_inputLayer->num_inputs());
+  const size_t numLayers = m_hiddenLayers.size() + 1;
+  const size_t n = inputs.cols();
+  ws.layers.resize(numLayers);
+  ws.inputs = inputs;
+
+  for (size_t i = 0; i < numLayers; i++) {
+    const HiddenLayer &l = layer(i);
+    const ActivationFunction &fn = l.get_activation_fn();
+    LayerWorkspace &lw = ws.layers[i];
+    const size_t rows = l.m_weights.rows();
+    const bool hidden = i + 1 < numLayers;
+
+    const GemmOperand prev =
+        i == 0 ? GemmOperand{inputs.data(), nullptr, inputs.row_stride(),
+                             inputs.col_stride()}
+               : GemmOperand{nullptr, ws.layers[i - 1].activationsBf16.data(),
+                             n, 1};
+    lw.z.resize(rows, n);
+
+    // the output layer stays fp32 for the cost
+    GemmEpilogue ep = {l.m_bias.data(), &fn, nullptr, n, nullptr};
+    if (hidden) {
+      lw.activationsBf16.resize(rows * n);
+      ep.outBf16 = lw.activationsBf16.data();
     } else {
-      weightGradients[i] =
-          delta.dot_multiply(m_inputLayer->get_activations().transpose());
+      lw.activations.resize(rows, n);
+      ep.out = lw.activations.data();
+    }
+
+    if (fn.elementwise()) {
+      gemm_mixed(rows, n, l.m_weights.cols(), 1.0f, weights_operand(i, false),
+                 prev, 0.0f, lw.z.data(), n, 1, &ep);
+      continue;
+    }
+
+    gemm_mixed(rows, n, l.m_weights.cols(), 1.0f, weights_operand(i, false),
+               prev, 0.0f, lw.z.data(), n, 1);
+    for (size_t r = 0; r < rows; r++) {
+      float *row = lw.z.data() + r * n;
+      kernels().add_scalar(row, l.m_bias.data()[r], row, n);
     }
+    lw.activations = lw.z;
+    fn.activate_inplace(lw.activations);
+    if (hidden)
+      kernels().to_bf16(lw.activations.data(), lw.activationsBf16.data(),
+                        rows * n);
   }
+}
 
-  return std::tuple<std::vector<Matrix>, std::vector<Matrix>>(weightGradients,
-                                                              biasGradients);
+void NeuralNetwork::backward_bf16(const MatrixView &ys, Workspace &ws) const {
+  const size_t numLayers = m_hiddenLayers.size() + 1;
+  assert(ws.layers.size() == numLayers);
+  const Matrix &out = ws.layers.back().activations;
+  assert(ys.rows() == out.rows() && ys.cols() == out.cols());
+  const size_t n = out.cols();
+  bind_gradients(ws);
+
+  Matrix &delta = ws.deltas[0];
+  for (int i = numLayers - 1; i >= 0; i--) {
+    const HiddenLayer &l = layer(i);
+    LayerWorkspace &lw = ws.layers[i];
+
+    if (i == (int)numLayers - 1) {
+      CostFunction::get_from_name(m_costFunction).deriv_into(out, ys, delta);
+    } else {
+      // W_next^T * delta_next, the latter still in deltaBf16
+      const Matrix &nextWeights = layer(i + 1).m_weights;
+      delta.resize(nextWeights.cols(), n);
+      gemm_mixed(nextWeights.cols(), n, nextWeights.rows(), 1.0f,
+                 weights_operand(i + 1, true),
+                 {nullptr, ws.deltaBf16.data(), n, 1}, 0.0f, delta.data(), n,
+                 1);
+    }
+    mul_activation_deriv(l.get_activation_fn(), lw.z, delta);
+    row_sums_into(lw.biasGradient, delta);
+
+    ws.deltaBf16.resize(delta.size());
+    kernels().to_bf16(delta.data(), ws.deltaBf16.data(), delta.size());
+
+    // dW = delta * prev^T, summed over the batch in fp32
+    const GemmOperand prevT =
+        i == 0 ? GemmOperand{ws.inputs.data(), nullptr,
+                             ws.inputs.col_stride(), ws.inputs.row_stride()}
+               : GemmOperand{nullptr, ws.layers[i - 1].activationsBf16.data(),
+                             1, n};
+    gemm_mixed(lw.weightGradient.rows(), lw.weightGradient.cols(), n, 1.0f,
+               {nullptr, ws.deltaBf16.data(), n, 1}, prevT, 0.0f,
+               lw.weightGradient.data(), lw.weightGradient.cols(), 1);
+  }
 }
 
 void NeuralNetwork::train(const Matrix &trainX, const Matrix &trainY,
-                          size_t batchSize, size_t epochs, float learningRate) {
+                          size_t batchSize, size_t epochs, float learningRate,
+                          uint64_t shuffleSeed) {
   assert(m_costFunction.size() > 0);
-  for (size_t e = 0; e < epochs; e++) {
-    size_t batchNum = 0;
-
-    const auto [trainXS, trainYS] = shuffle_train(trainX, trainY);
-    for (size_t i = 0; i < trainX.cols(); i += batchSize, batchNum++) {
-      update_batch(trainX, trainY, i, std::min(i + batchSize, trainX.cols()),
-                   learningRate);
-
-      int correct = 0;
-      for (size_t j = i; j < std::min(i + batchSize, trainX.cols()); j++) {
-        Matrix out = forward(trainX.get_col(j));
-        int correctIdx = 0;
-        int maxIdx = 0;
-        float maxVal = 0;
-
-        for (size_t k = 0; k < out.rows(); k++) {
-          float x = out.get(k, 0);
-          if (x > maxVal) {
-            maxVal = x;
-            maxIdx = k;
-          }
-        }
+  plan_training(batchSize);
+
+  // batches are gathered on a background thread while this one trains,
+  // given a core to spare for it
+  const size_t depth = std::thread::hardware_concurrency() > 1 ? 2 : 0;
+  BatchPrefetcher batches(trainX, trainY, batchSize, epochs, shuffleSeed,
+                          depth);
+  Evaluator evaluator(*this, 1, batchSize);
+  size_t steps = 0;
+  while (const BatchPrefetcher::Batch *batch = batches.next()) {
+    const Matrix &batchX = batch->x;
+    const Matrix &batchY = batch->y;
+    update_batch(batchX, batchY, 0, batchX.cols(), learningRate);
+    steps++;
+
+    const PruningSchedule &p = m_pruning;
+    if (p.sparsity > 0.0f && steps >= p.begin && steps <= p.end &&
+        ((steps - p.begin) % std::max<size_t>(p.interval, 1) == 0 ||
+         steps == p.end)) {
+      const float progress =
+          p.end > p.begin ? (float)(steps - p.begin) / (p.end - p.begin) : 1;
+      const float remaining = 1.0f - progress;
+      prune(p.sparsity * (1.0f - remaining * remaining * remaining));
+    }
 
-        for (size_t k = 0; k < out.rows(); k++) {
-          if (trainY.get(k, j) == 1) {
-            correctIdx = k;
-            break;
+    if (m_evalInterval == 0 || steps % m_evalInterval != 0)
+      continue;
+    const EvalResult res = evaluator.evaluate(batchX, batchY);
+    std::cout << "BATCH " << batch->index << " EPOCH " << batch->epoch
+              << " \t| ACCURACY: " << res.accuracy()
+              << " \t| LOSS: " << res.mean_loss() << "\n";
+  }
+}
+
+void NeuralNetwork::train_hogwild(const Matrix &trainX, const Matrix &trainY,
+                                  size_t batchSize, size_t epochs,
+                                  float learningRate, size_t numThreads,
+                                  const std::vector<float> &stepScales,
+                                  uint64_t shuffleSeed) {
+  assert(m_costFunction.size() > 0);
+  assert(trainX.cols() == trainY.cols() && batchSize > 0);
+
+  if (frozen())
+    unfreeze();
+  if (!parameters_bound())
+    bind_parameters();
+
+  const size_t poolThreads = thread_pool().num_threads();
+  const size_t workers =
+      numThreads > 0 ? std::min(numThreads, poolThreads) : poolThreads;
+  if (m_workspaces.size() < workers)
+    m_workspaces.resize(workers);
+  for (size_t t = 0; t < workers; t++)
+    plan_workspace(m_workspaces[t], batchSize);
+
+  // per worker, reused across epochs
+  std::vector<Matrix> batchX(workers), batchY(workers);
+  std::vector<std::vector<size_t>> batchCols(workers);
+
+  BatchSampler sampler(trainX, trainY, batchSize, shuffleSeed);
+  const size_t batches = sampler.num_batches();
+  const size_t numLayers = m_hiddenLayers.size() + 1;
+
+  for (size_t epoch = 0; epoch < epochs; epoch++) {
+    sampler.start_epoch(epoch);
+    std::atomic<size_t> next{0};
+
+    thread_pool().parallel_for(workers, [&](size_t t) {
+      Workspace &ws = m_workspaces[t];
+      Matrix &x = batchX[t];
+      const float scale = t < stepScales.size() ? stepScales[t] : 1.0f;
+      std::vector<size_t> activeInputs;
+
+      size_t b;
+      while ((b = next.fetch_add(1, std::memory_order_relaxed)) < batches) {
+        sampler.gather(b, x, batchY[t], batchCols[t]);
+        const size_t n = x.cols();
+
+        forward(x, ws);
+        backward(batchY[t], ws);
+
+        // inputs that are zero across the batch have zero weight gradients
+        activeInputs.clear();
+        for (size_t r = 0; r < x.rows(); r++) {
+          const float *row = x.data() + r * n;
+          for (size_t j = 0; j < n; j++) {
+            if (row[j] != 0.0f) {
+              activeInputs.push_back(r);
+              break;
+            }
           }
         }
+        const bool sparse = activeInputs.size() * 2 < x.rows();
 
-        if (correctIdx == maxIdx)
-          correct++;
+        const float step = learningRate * scale / n;
+        for (size_t i = 0; i < numLayers; i++) {
+          sgd_update(mutable_layer(i), ws.layers[i], step,
+                     i == 0 && sparse ? &activeInputs : nullptr);
+        }
       }
-
-      std::cout << "BATCH " << batchNum << " EPOCH " << e
-                << " \t| ACCURACY: " << ((float)correct / batchSize) << "\n";
-    }
+    });
   }
+  apply_prune_mask();
 }
 
 void NeuralNetwork::save(std::filesystem::path outPath) {
@@ -213,8 +710,17 @@ void NeuralNetwork::save(std::filesystem::path outPath) {
 
   std::cout << "Saving model to " << outPath << "...";
 
-  stream.write("DENDRITE_MODEL\0",
-               15); // All model files will start with this
+  // tagged files mark every layer as dense or CSR
+  bool tagged = false;
+  for (std::shared_ptr<HiddenLayer> hl : m_hiddenLayers)
+    tagged |= hl->sparse_storage();
+  tagged |= m_outputLayer->sparse_storage();
+
+  if (tagged)
+    stream.write("DENDRITE_MODEL_V2\0", 18);
+  else
+    stream.write("DENDRITE_MODEL\0",
+                 15); // All model files will start with this
   uint64_t numLayers = num_layers();
   stream.write((const char *)&numLayers,
                sizeof(numLayers)); // Number of layers
@@ -228,9 +734,9 @@ void NeuralNetwork::save(std::filesystem::path outPath) {
 
   // Iterate over hidden layers
   for (std::shared_ptr<HiddenLayer> hl : m_hiddenLayers) {
-    hl->write(stream);
+    hl->write(stream, tagged);
   }
-  m_outputLayer->write(stream);
+  m_outputLayer->write(stream, tagged);
 
   stream.close();
   std::cout << "Model saved!\n";
@@ -244,7 +750,8 @@ void NeuralNetwork::load(std::filesystem::path path) {
   std::string fileType;
   std::getline(stream, fileType, '\0');
 
-  if (fileType != "DENDRITE_MODEL") {
+  const bool tagged = fileType == "DENDRITE_MODEL_V2";
+  if (fileType != "DENDRITE_MODEL" && !tagged) {
     std::cerr << "Invalid model file type for " << path << "!\n";
     return;
   }
@@ -273,14 +780,16 @@ void NeuralNetwork::load(std::filesystem::path path) {
       prev = m_hiddenLayers[m_hiddenLayers.size() - 1];
     }
 
-    HiddenLayer hl = HiddenLayer::load(stream, prev);
+    HiddenLayer hl = HiddenLayer::load(stream, prev, tagged);
 
-    m_hiddenLayers.emplace_back(std::make_shared<HiddenLayer>(hl));
+    m_hiddenLayers.emplace_back(std::make_shared<HiddenLayer>(std::move(hl)));
   }
   m_outputLayer = std::make_shared<OutputLayer>(
-      OutputLayer::load(stream, m_hiddenLayers.back()));
+      OutputLayer::load(stream, m_hiddenLayers.back(), tagged));
 
   stream.close();
+  bind_parameters();
+  freeze();
 }
 
 size_t NeuralNetwork::num_layers() const {
@@ -3,51 +3,107 @@
 
 #include "math/ActivationFunction.hpp"
 #include "math/CostFunction.hpp"
+#include "math/Gemm.hpp"
 #include "math/Matrix.hpp"
 #include "nn/Layer.hpp"
+#include "nn/Optimizer.hpp"
+#include "nn/Workspace.hpp"
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <filesystem>
 #include <memory>
-#include <random>
 #include <string>
 
 namespace Dendrite {
+// Storage used by update_batch() steps. BF16 keeps the hidden layers'
+// activations and the deltas in bfloat16, halving what the backward GEMMs
+// stream; z, the output layer, gradients and the optimizer stay fp32.
+// BF16_WEIGHTS also runs the GEMMs off a bf16 copy of the weights, rounded
+// from the fp32 master weights at the start of every step. Inference and
+// train_hogwild() always run in fp32.
+enum class Precision { FP32, BF16, BF16_WEIGHTS };
+
+// Gradual magnitude pruning for train(): at step begin, and every interval
+// steps after it until end, the hidden layers are pruned to
+//   sparsity * (1 - (1 - (step - begin) / (end - begin))^3)
+// which prunes quickly while there is plenty of redundancy and slowly as
+// the target nears. Steps after end fine-tune what's left.
+struct PruningSchedule {
+  float sparsity = 0.0f; // 0 for none
+  size_t begin = 0;
+  size_t end = 0;
+  size_t interval = 100;
+};
+
 class NeuralNetwork {
 private:
   std::vector<std::shared_ptr<HiddenLayer>> m_hiddenLayers;
   std::shared_ptr<OutputLayer> m_outputLayer;
   std::shared_ptr<InputLayer> m_inputLayer;
   std::string m_costFunction;
-
-  std::tuple<Matrix, Matrix> shuffle_train(const Matrix &trainX,
-                                           const Matrix &trainY) {
-    assert(trainX.cols() == trainY.cols());
-
-    std::vector<size_t> indices = std::vector<size_t>(trainX.cols());
-    for (size_t i = 0; i < trainX.cols(); i++) {
-      indices.push_back(i);
-    }
-    std::shuffle(indices.begin(), indices.end(), std::default_random_engine{});
-
-    Matrix trainXS = Matrix::with_same_shape(trainX);
-    Matrix trainYS = Matrix::with_same_shape(trainY);
-
-    for (size_t i = 0; i < trainX.cols(); i++) {
-      for (size_t r = 0; r < trainX.rows(); r++) {
-        trainXS.set(r, i, trainX.get(r, indices[i]));
-      }
-      for (size_t r = 0; r < trainY.rows(); r++) {
-        trainYS.set(r, i, trainY.get(r, indices[i]));
-      }
-    }
-
-    return std::tuple<Matrix, Matrix>(trainXS, trainYS);
+  std::string m_optimizer = "sgd";
+
+  // Every layer's weights and bias back to back, each starting on a cache
+  // line. The layers' matrices borrow from it, see bind_parameters().
+  Matrix m_parameters;
+  // Start of layer i's weights at [2i] and bias at [2i + 1], then the total.
+  // Workspace gradients share the layout.
+  std::vector<size_t> m_paramOffsets;
+  OptimizerState m_optimizerState; // laid out like m_parameters
+
+  // 0 for every pruned weight and 1 elsewhere, laid out like m_parameters
+  // and applied after every optimizer step. Empty while nothing is pruned.
+  PoolVector<float> m_pruneMask;
+  PruningSchedule m_pruning;
+
+  Precision m_precision = Precision::FP32;
+  PoolVector<BFloat16> m_parametersBf16; // BF16_WEIGHTS only, same layout
+
+  // One per training shard, reused across steps, see update_batch()
+  std::vector<Workspace> m_workspaces;
+  Workspace m_inferenceWorkspace; // for the non-const forward() overloads
+  size_t m_trainThreads = 0;
+  size_t m_evalInterval = 100;
+
+  HiddenLayer &mutable_layer(size_t i) {
+    return i < m_hiddenLayers.size() ? *m_hiddenLayers[i] : *m_outputLayer;
   }
 
+  // Backward pass over the batch the last forward() on ws ran on, ys
+  // holding the matching truth columns. Writes the gradients, summed over
+  // the batch, into ws.
+  void backward(const MatrixView &ys, Workspace &ws) const;
+
+  // forward() and backward() for the bf16 precisions
+  void forward_bf16(const MatrixView &inputs, Workspace &ws) const;
+  void backward_bf16(const MatrixView &ys, Workspace &ws) const;
+
+  // Layer i's weights as a GEMM operand in the current precision
+  GemmOperand weights_operand(size_t i, bool transposed) const;
+
+  // Moves every layer's parameters into m_parameters, after init(), load()
+  // or a change to the topology. Drops the optimizer state.
+  void bind_parameters();
+  bool parameters_bound() const;
+
+  // Rebuilds m_pruneMask from the pruned layers' zeros
+  void build_prune_mask();
+  void apply_prune_mask();
+
+  // Points ws's per-layer gradients into its flat gradient buffer
+  void bind_gradients(Workspace &ws) const;
+
+  size_t num_shards(size_t batchSize) const;
+
+  // Sums the first shards workspaces' gradients into m_workspaces[0],
+  // pairwise in log2(shards) parallel rounds.
+  void reduce_gradients(size_t shards);
+
 public:
   NeuralNetwork(const NeuralNetwork &other)
-      : m_costFunction(other.m_costFunction) {}
+      : m_costFunction(other.m_costFunction),
+        m_optimizer(other.m_optimizer), m_precision(other.m_precision) {}
   NeuralNetwork(const std::string costFn) : m_costFunction(costFn) {}
   NeuralNetwork() {}
 
@@ -59,17 +115,134 @@ public:
 
   void init();
 
-  Matrix forward(const Matrix &inputs);
+  // Hidden layers, then the output layer: num_layers() - 1 of them
+  const HiddenLayer &layer(size_t i) const {
+    return i < m_hiddenLayers.size() ? *m_hiddenLayers[i] : *m_outputLayer;
+  }
+
+  // Reentrant inference: only reads the network, every intermediate goes
+  // to ws. Any number of threads can run these at once, each with its own
+  // workspace, as long as nothing trains, loads or (un)freezes the network
+  // meanwhile. Returns the output activations, which live in ws.
+  const Matrix &forward(const MatrixView &inputs, Workspace &ws) const;
+
+  // Runs inputs (inputs x N) through the network maxBatch columns at a time
+  // into outputs (outputs x N, resized if needed). Workspace buffers are
+  // sized to one chunk and reused across chunks and calls.
+  void forward_batch(const MatrixView &inputs, Matrix &outputs, Workspace &ws,
+                     size_t maxBatch = 256) const;
+
+  // Single-threaded conveniences over a workspace owned by the network. The
+  // returned reference stays valid, but the values are overwritten by the
+  // next call.
+  const Matrix &forward(const MatrixView &inputs);
+  void forward_batch(const MatrixView &inputs, Matrix &outputs,
+                     size_t maxBatch = 256);
+  Matrix forward_batch(const MatrixView &inputs, size_t maxBatch = 256);
+
+  // Packs every layer's weights for latency-bound, one sample at a time
+  // inference. load() freezes the model; training unfreezes it.
+  void freeze();
+  void unfreeze();
+  bool frozen() const;
+
+  // Every parameter in one flat buffer, in layer order, weights before bias
+  const Matrix &parameters() const { return m_parameters; }
+
+  // Optimizer update_batch() steps with, by its registered name ("sgd",
+  // "momentum", "nesterov", "adam", "adamw", see init_functions()).
+  // Switching drops the optimizer's state.
+  void set_optimizer(const std::string &name);
+  const std::string &optimizer() const { return m_optimizer; }
+
+  void set_precision(Precision precision);
+  Precision precision() const { return m_precision; }
+
+  const std::string &cost_function() const { return m_costFunction; }
+
+  // Zeroes the smallest-magnitude sparsity of each hidden layer's weights,
+  // which later training keeps at zero. The output layer is left dense: it
+  // is small and the most sensitive to pruning. A frozen network is
+  // refrozen, so layers sparse enough switch to CSR.
+  void prune(float sparsity);
+
+  void set_pruning_schedule(const PruningSchedule &schedule) {
+    m_pruning = schedule;
+  }
+  const PruningSchedule &pruning_schedule() const { return m_pruning; }
+
+  // One optimizer step over columns [start, end), run as a whole minibatch:
+  // each layer's z, activations and deltas are neurons x batch, so forward
+  // and backward are a few GEMMs per layer.
+  //
+  // Data parallel: the batch is split into up to train_threads() column
+  // shards, each run on its own thread and Workspace, and the partial
+  // gradients are tree reduced before the update. Workspaces live in the
+  // network and are planned by plan_training(), so steps no larger than an
+  // earlier one don't allocate.
 
   void update_batch(const Matrix &xs, const Matrix &ys, size_t start,
                     size_t end, float learningRate);
 
+  // Sizes every buffer in ws for batches of up to batchSize columns, from
+  // the topology alone, so passes of that size never allocate. Without
+  // training only the forward buffers are planned. Returns ws.bytes().
+  size_t plan_workspace(Workspace &ws, size_t batchSize,
+                        bool training = true) const;
+
+  // Plans the per-shard training workspaces for update_batch() steps of up
+  // to batchSize columns and returns their total bytes, the peak training
+  // memory on top of the parameters. train() calls this up front.
+  size_t plan_training(size_t batchSize);
+
+  // Shards per training step, 0 (the default) for one per pool thread. Small
+  // batches use fewer, so every shard keeps enough columns for a GEMM.
+  void set_train_threads(size_t numThreads) { m_trainThreads = numThreads; }
+  size_t train_threads() const;
+
+  // Steps between train()'s progress reports, 0 for none
+  void set_eval_interval(size_t steps) { m_evalInterval = steps; }
+  size_t eval_interval() const { return m_evalInterval; }
+
   std::tuple<std::vector<Matrix>, std::vector<Matrix>>
   backprop(const Matrix &xs, const Matrix &ys, size_t exampleIndex);
 
-  void train(const Matrix &trainX, const Matrix &trainY, size_t batchSize,
-             size_t epochs, float learningRate);
+  // Adds this example's gradients onto weightGradients/biasGradients (one
+  // per hidden layer, then the output layer) instead of returning new ones.
+  void backprop(const Matrix &xs, const Matrix &ys, size_t exampleIndex,
+                std::vector<Matrix> &weightGradients,
+                std::vector<Matrix> &biasGradients);
 
+  // Minibatch training, every epoch in a fresh order that depends only on
+  // shuffleSeed and the epoch, see BatchSampler. Every eval_interval()
+  // steps the batch just trained on is scored and printed. Prunes as the
+  // pruning_schedule() says.
+  void train(const Matrix &trainX, const Matrix &trainY, size_t batchSize,
+             size_t epochs, float learningRate, uint64_t shuffleSeed = 0);
+
+  // Asynchronous SGD in the style of Hogwild: numThreads workers (0 for one
+  // per pool thread) pull batchSize-column batches off a shared counter and
+  // each apply their own step straight to the shared weights, with no
+  // barrier between steps. Worker t steps by
+  // learningRate * stepScales[t] / batchSize, the scale being 1 for workers
+  // past the end of stepScales. Each epoch walks its batches in a fresh
+  // BatchSampler order for shuffleSeed, like train(); the workers meet at
+  // the end of every epoch while it's reshuffled.
+  //
+  // Writes from different workers race by design (a lost update only costs
+  // a bit of progress), so thread sanitizers will flag this mode. For the
+  // first layer only the weight columns of inputs that are nonzero in the
+  // batch are written, which keeps collisions rare on sparse inputs. Always
+  // plain SGD, whatever set_optimizer() says: optimizer state would race
+  // too. Pruned weights are only zeroed again once the workers are done.
+  void train_hogwild(const Matrix &trainX, const Matrix &trainY,
+                     size_t batchSize, size_t epochs, float learningRate,
+                     size_t numThreads = 0,
+                     const std::vector<float> &stepScales = {},
+                     uint64_t shuffleSeed = 0);
+
+  // Layers that are mostly zero after prune() are stored as CSR. Files
+  // with none keep the original format, so older builds still read them.
   void save(std::filesystem::path outPath);
 
   void load(std::filesystem::path path);
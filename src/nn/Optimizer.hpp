@@ -0,0 +1,50 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "math/Matrix.hpp"
+#include <map>
+#include <string>
+
+namespace Dendrite {
+// What an optimizer remembers about a parameter matrix between steps. The
+// network keeps one for its flat parameter buffer.
+struct OptimizerState {
+  Matrix first;  // velocity, or Adam's first moment
+  Matrix second; // Adam's second moment
+  size_t step = 0;
+
+  // Sizes the slots the optimizer uses to params, zeroed, on first use
+  void prepare(const Matrix &params, size_t slots) {
+    if (slots > 0 && !first.same_shape(params)) {
+      first.resize(params.rows(), params.cols());
+      first.fill(0.0f);
+    }
+    if (slots > 1 && !second.same_shape(params)) {
+      second.resize(params.rows(), params.cols());
+      second.fill(0.0f);
+    }
+  }
+};
+
+class Optimizer {
+public:
+  // One step on params from grad, the gradient summed over a batch, which
+  // is scaled by gradScale (1 / batch size) on the fly. A single pass over
+  // params, grad and state, nothing is allocated after the first step.
+  virtual void update(Matrix &params, const Matrix &grad,
+                      OptimizerState &state, float learningRate,
+                      float gradScale) const = 0;
+
+  inline static std::map<std::string, Optimizer *> s_optimizers;
+
+  static void register_func(const std::string &name, Optimizer *optimizer) {
+    s_optimizers[name] = optimizer;
+  }
+
+  static Optimizer &get_from_name(const std::string &name) {
+    return *s_optimizers.at(name);
+  }
+};
+} // namespace Dendrite
+
+#endif // !OPTIMIZER_H
@@ -0,0 +1,300 @@
+#include "QuantizedNetwork.hpp"
+#include "core/ThreadPool.hpp"
+#include "math/simd/Kernels.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace Dendrite {
+namespace {
+// Columns per forward_chunk(). Narrower chunks keep the quantized inputs in
+// L1 but then read each row of the float inputs in short strided pieces,
+// which costs more than the dot products save.
+constexpr size_t CHUNK = 256;
+
+// Calibration batch size
+constexpr size_t CALIBRATION_BATCH = 256;
+
+void widen_range(const MatrixView &x, float &lo, float &hi) {
+  for (size_t i = 0; i < x.rows(); i++) {
+    for (size_t j = 0; j < x.cols(); j++) {
+      const float v = x.get(i, j);
+      lo = std::min(lo, v);
+      hi = std::max(hi, v);
+    }
+  }
+}
+
+size_t round_up(size_t n, size_t multiple) {
+  return (n + multiple - 1) / multiple * multiple;
+}
+
+// Eight lanes as GNU vectors: the clamps keep a scalar loop from
+// vectorizing, as FP compares may trap
+typedef float Lanes __attribute__((vector_size(8 * sizeof(float))));
+typedef int32_t LaneInts __attribute__((vector_size(8 * sizeof(int32_t))));
+
+// Clamps before rounding, so adding a half and truncating rounds
+inline uint32_t quantize_one(float x, float inv, float zero) {
+  const float v = std::min(255.0f, std::max(0.0f, x * inv + zero));
+  return (uint32_t)(int32_t)(v + 0.5f);
+}
+
+// ORs quantized row[j] << shift into words[j]
+void quantize_row(const float *row, size_t n, float inv, float zero,
+                  int shift, uint32_t *words) {
+  const Lanes lo = {};
+  const Lanes hi = lo + 255.0f;
+  size_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    Lanes v;
+    LaneInts w;
+    std::memcpy(&v, row + j, sizeof(v));
+    std::memcpy(&w, words + j, sizeof(w));
+    v = v * inv + zero;
+    v = v < lo ? lo : v;
+    v = v > hi ? hi : v;
+    w |= __builtin_convertvector(v + 0.5f, LaneInts) << shift;
+    std::memcpy(words + j, &w, sizeof(w));
+  }
+  for (; j < n; j++)
+    words[j] |= quantize_one(row[j], inv, zero) << shift;
+}
+
+// x to uint8, x ~ scale * (q - zero), interleaved for Kernels::dot_u8s8
+// over cols columns: one word per column per four rows of x
+void quantize_columns(const MatrixView &x, float scale, uint8_t zero,
+                      uint32_t *q, size_t cols) {
+  const float inv = 1.0f / scale;
+  const size_t n = x.cols();
+
+  for (size_t p0 = 0; p0 < x.rows(); p0 += 4) {
+    uint32_t *words = q + (p0 / 4) * cols;
+    std::fill(words, words + n, 0u);
+    for (size_t t = 0; t < 4 && p0 + t < x.rows(); t++) {
+      const float *row = x.data() + (p0 + t) * x.row_stride();
+      if (x.col_stride() == 1) {
+        quantize_row(row, n, inv, zero, 8 * t, words);
+        continue;
+      }
+      for (size_t j = 0; j < n; j++)
+        words[j] |= quantize_one(row[j * x.col_stride()], inv, zero)
+                    << (8 * t);
+    }
+  }
+}
+} // namespace
+
+QuantizedNetwork QuantizedNetwork::quantize(const NeuralNetwork &net,
+                                            const MatrixView &calibration) {
+  const size_t numLayers = net.num_layers() - 1;
+  assert(numLayers > 0 && calibration.cols() > 0);
+
+  // every layer's input range, widened to take in 0 so it quantizes exactly
+  std::vector<float> lo(numLayers, 0.0f), hi(numLayers, 0.0f);
+  Workspace ws;
+  for (size_t j = 0; j < calibration.cols(); j += CALIBRATION_BATCH) {
+    const size_t n = std::min(CALIBRATION_BATCH, calibration.cols() - j);
+    const MatrixView x = calibration.block(0, j, calibration.rows(), n);
+    net.forward(x, ws);
+
+    widen_range(x, lo[0], hi[0]);
+    for (size_t i = 1; i < numLayers; i++)
+      widen_range(ws.layers[i - 1].activations, lo[i], hi[i]);
+  }
+
+  QuantizedNetwork out;
+  out.m_costFunction = net.cost_function();
+  out.m_layers.resize(numLayers);
+  for (size_t i = 0; i < numLayers; i++) {
+    const HiddenLayer &src = net.layer(i);
+    QuantizedLayer &l = out.m_layers[i];
+    l.rows = src.m_weights.rows();
+    l.cols = src.m_weights.cols();
+    l.stride = round_up(l.cols, 4);
+    l.fn = src.get_activation_fn_name();
+    l.bias.assign(src.m_bias.data(), src.m_bias.data() + l.rows);
+
+    l.inputScale = hi[i] > lo[i] ? (hi[i] - lo[i]) / 255.0f : 1.0f;
+    l.inputZero = (uint8_t)std::nearbyint(-lo[i] / l.inputScale);
+
+    l.weights.assign(l.rows * l.stride, 0);
+    l.weightScales.resize(l.rows);
+    l.rowSums.assign(l.rows, 0);
+    for (size_t r = 0; r < l.rows; r++) {
+      const float *w = src.m_weights.data() + r * l.cols;
+      float maxAbs = 0.0f;
+      for (size_t p = 0; p < l.cols; p++)
+        maxAbs = std::max(maxAbs, std::fabs(w[p]));
+      const float scale = maxAbs > 0.0f ? maxAbs / 127.0f : 1.0f;
+
+      l.weightScales[r] = scale;
+      for (size_t p = 0; p < l.cols; p++) {
+        const int8_t q = (int8_t)std::nearbyint(w[p] / scale);
+        l.weights[r * l.stride + p] = q;
+        l.rowSums[r] += q;
+      }
+    }
+  }
+  return out;
+}
+
+void QuantizedNetwork::forward_chunk(const MatrixView &inputs, float *out,
+                                     size_t ldo) const {
+  thread_local PoolVector<uint32_t> quantized; // four uint8 per word
+  thread_local PoolVector<int32_t> acc;
+  thread_local Matrix activations[2];
+  const size_t n = inputs.cols();
+  const size_t cols = round_up(n, QUANT_COLS); // padding columns are unused
+
+  MatrixView in = inputs;
+  for (size_t i = 0; i < m_layers.size(); i++) {
+    const QuantizedLayer &l = m_layers[i];
+    const ActivationFunction &fn = ActivationFunction::get_from_name(l.fn);
+
+    // any padding k meets zero weights
+    quantized.resize(l.stride / 4 * cols);
+    quantize_columns(in, l.inputScale, l.inputZero, quantized.data(), cols);
+    acc.resize(l.rows * cols);
+    kernels().dot_u8s8(l.rows, cols, l.stride, l.weights.data(),
+                       reinterpret_cast<const uint8_t *>(quantized.data()),
+                       acc.data(), cols);
+
+    // sum_p w_p * s * (q_p - zero) = s * (dot - zero * sum_p w_p)
+    Matrix &z = activations[i % 2];
+    z.resize(l.rows, n);
+    for (size_t r = 0; r < l.rows; r++) {
+      const float scale = l.weightScales[r] * l.inputScale;
+      const int32_t offset = l.inputZero * l.rowSums[r];
+      float *row = z.data() + r * n;
+      for (size_t j = 0; j < n; j++)
+        row[j] = scale * (float)(acc[r * cols + j] - offset) + l.bias[r];
+      if (fn.elementwise())
+        fn.activate_span(row, row, n);
+    }
+    if (!fn.elementwise())
+      fn.activate_inplace(z);
+    in = z.view();
+  }
+
+  const Matrix &last = activations[(m_layers.size() - 1) % 2];
+  for (size_t r = 0; r < last.rows(); r++) {
+    std::copy(last.data() + r * n, last.data() + (r + 1) * n, out + r * ldo);
+  }
+}
+
+void QuantizedNetwork::forward(const MatrixView &inputs,
+                               Matrix &outputs) const {
+  assert(!m_layers.empty() && inputs.rows() == num_inputs());
+  outputs.resize(num_outputs(), inputs.cols());
+
+  const size_t chunks = (inputs.cols() + CHUNK - 1) / CHUNK;
+  thread_pool().parallel_for(chunks, [&](size_t c) {
+    const size_t j = c * CHUNK;
+    const size_t n = std::min(CHUNK, inputs.cols() - j);
+    forward_chunk(inputs.block(0, j, inputs.rows(), n), outputs.data() + j,
+                  outputs.cols());
+  });
+}
+
+Matrix QuantizedNetwork::forward(const MatrixView &inputs) const {
+  Matrix outputs;
+  forward(inputs, outputs);
+  return outputs;
+}
+
+void QuantizedNetwork::save(std::filesystem::path outPath) const {
+  assert(!m_layers.empty());
+  std::ofstream stream(outPath, std::ios::out | std::ios::binary);
+
+  if (!stream.is_open()) {
+    std::cerr << "Couldn't open output stream for " << outPath << "\n";
+    return;
+  }
+
+  std::cout << "Saving quantized model to " << outPath << "...";
+
+  stream.write("DENDRITE_QMODEL\0", 16);
+  uint64_t numLayers = m_layers.size();
+  stream.write((const char *)&numLayers, sizeof(numLayers));
+  stream.write(m_costFunction.c_str(), m_costFunction.size() + 1);
+
+  for (const QuantizedLayer &l : m_layers) {
+    uint64_t rows = l.rows;
+    uint64_t cols = l.cols;
+    stream.write(reinterpret_cast<const char *>(&rows), sizeof(rows));
+    stream.write(reinterpret_cast<const char *>(&cols), sizeof(cols));
+    stream.write(l.fn.c_str(), l.fn.size() + 1);
+    stream.write(reinterpret_cast<const char *>(&l.inputScale),
+                 sizeof(l.inputScale));
+    stream.write(reinterpret_cast<const char *>(&l.inputZero),
+                 sizeof(l.inputZero));
+    stream.write(reinterpret_cast<const char *>(l.weightScales.data()),
+                 l.rows * sizeof(float));
+    stream.write(reinterpret_cast<const char *>(l.bias.data()),
+                 l.rows * sizeof(float));
+    // unpadded, one row at a time
+    for (size_t r = 0; r < l.rows; r++) {
+      stream.write(reinterpret_cast<const char *>(l.weights.data()) +
+                       r * l.stride,
+                   l.cols);
+    }
+  }
+
+  stream.close();
+  std::cout << "Model saved!\n";
+}
+
+void QuantizedNetwork::load(std::filesystem::path path) {
+  assert(m_layers.empty());
+
+  std::ifstream stream(path, std::ios::binary);
+
+  std::string fileType;
+  std::getline(stream, fileType, '\0');
+
+  if (fileType != "DENDRITE_QMODEL") {
+    std::cerr << "Invalid quantized model file type for " << path << "!\n";
+    return;
+  }
+
+  uint64_t numLayers = 0;
+  stream.read(reinterpret_cast<char *>(&numLayers), sizeof(numLayers));
+  std::getline(stream, m_costFunction, '\0');
+
+  m_layers.resize(numLayers);
+  for (QuantizedLayer &l : m_layers) {
+    uint64_t rows;
+    uint64_t cols;
+    stream.read(reinterpret_cast<char *>(&rows), sizeof(rows));
+    stream.read(reinterpret_cast<char *>(&cols), sizeof(cols));
+    l.rows = rows;
+    l.cols = cols;
+    l.stride = round_up(l.cols, 4);
+    std::getline(stream, l.fn, '\0');
+    stream.read(reinterpret_cast<char *>(&l.inputScale),
+                sizeof(l.inputScale));
+    stream.read(reinterpret_cast<char *>(&l.inputZero), sizeof(l.inputZero));
+
+    l.weightScales.resize(l.rows);
+    l.bias.resize(l.rows);
+    stream.read(reinterpret_cast<char *>(l.weightScales.data()),
+                l.rows * sizeof(float));
+    stream.read(reinterpret_cast<char *>(l.bias.data()),
+                l.rows * sizeof(float));
+
+    l.weights.assign(l.rows * l.stride, 0);
+    l.rowSums.assign(l.rows, 0);
+    for (size_t r = 0; r < l.rows; r++) {
+      int8_t *row = l.weights.data() + r * l.stride;
+      stream.read(reinterpret_cast<char *>(row), l.cols);
+      for (size_t p = 0; p < l.cols; p++)
+        l.rowSums[r] += row[p];
+    }
+  }
+
+  stream.close();
+}
+} // namespace Dendrite
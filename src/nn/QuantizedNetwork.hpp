@@ -0,0 +1,62 @@
+#ifndef QUANTIZED_NETWORK_H
+#define QUANTIZED_NETWORK_H
+
+#include "core/Pool.hpp"
+#include "math/Matrix.hpp"
+#include "nn/NeuralNetwork.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace Dendrite {
+// Int8 copy of a trained network, for inference only. Weights are
+// quantized symmetrically per output neuron, w ~ weightScales[r] * q. Each
+// layer's input is quantized per tensor to uint8, x ~ inputScale *
+// (q - inputZero), over the range seen on calibration data. Every product
+// is an exact uint8 x int8 -> int32 dot product (Kernels::dot_u8s8), then
+// dequantized, biased and activated in fp32.
+class QuantizedNetwork {
+private:
+  struct QuantizedLayer {
+    size_t rows = 0;
+    size_t cols = 0;
+    size_t stride = 0; // cols rounded up to 4, zero padded
+    std::string fn;
+    PoolVector<int8_t> weights; // rows x stride
+    std::vector<float> weightScales;
+    std::vector<int32_t> rowSums; // of weights, to take inputZero back out
+    std::vector<float> bias;
+    float inputScale = 1.0f;
+    uint8_t inputZero = 0;
+  };
+
+  std::string m_costFunction;
+  std::vector<QuantizedLayer> m_layers;
+
+  // Runs up to a chunk of columns through every layer, writing the outputs
+  // to out (row stride ldo)
+  void forward_chunk(const MatrixView &inputs, float *out, size_t ldo) const;
+
+public:
+  // Quantizes net, calibrating every layer's input range on the columns of
+  // calibration (a few hundred representative inputs is plenty)
+  static QuantizedNetwork quantize(const NeuralNetwork &net,
+                                   const MatrixView &calibration);
+
+  // Runs inputs (inputs x N) into outputs (outputs x N, resized if needed),
+  // column chunks spread over thread_pool(). Only reads the network.
+  void forward(const MatrixView &inputs, Matrix &outputs) const;
+  Matrix forward(const MatrixView &inputs) const;
+
+  size_t num_inputs() const { return m_layers.front().cols; }
+  size_t num_outputs() const { return m_layers.back().rows; }
+  const std::string &cost_function() const { return m_costFunction; }
+
+  void save(std::filesystem::path outPath) const;
+
+  void load(std::filesystem::path path);
+};
+} // namespace Dendrite
+
+#endif // !QUANTIZED_NETWORK_H
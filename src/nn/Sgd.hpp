@@ -0,0 +1,37 @@
+#ifndef SGD_H
+#define SGD_H
+
+#include "math/simd/Kernels.hpp"
+#include "nn/Optimizer.hpp"
+#include <cassert>
+
+namespace Dendrite {
+// Plain SGD, or SGD with (Nesterov) momentum when momentum > 0.
+class Sgd : Optimizer {
+  float m_momentum;
+  bool m_nesterov;
+
+public:
+  Sgd(float momentum = 0.0f, bool nesterov = false)
+      : m_momentum(momentum), m_nesterov(nesterov) {}
+
+  void update(Matrix &params, const Matrix &grad, OptimizerState &state,
+              float learningRate, float gradScale) const override {
+    assert(params.same_shape(grad));
+
+    if (m_momentum == 0.0f) {
+      kernels().axpy(-learningRate * gradScale, grad.data(), params.data(),
+                     params.size());
+      return;
+    }
+
+    state.prepare(params, 1);
+    state.step++;
+    const MomentumStep s = {gradScale, learningRate, m_momentum, m_nesterov};
+    kernels().momentum(s, grad.data(), state.first.data(), params.data(),
+                       params.size());
+  }
+};
+} // namespace Dendrite
+
+#endif // !SGD_H
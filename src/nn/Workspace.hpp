@@ -0,0 +1,57 @@
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include "core/Pool.hpp"
+#include "math/BFloat16.hpp"
+#include "math/Matrix.hpp"
+#include <vector>
+
+namespace Dendrite {
+// Buffers for one hidden or output layer. All batch sized ones are
+// neurons x batch and only grow.
+struct LayerWorkspace {
+  Matrix z; // overwritten by fn'(z) in backward()
+  Matrix activations;
+  // Hidden layers' activations when training in bf16, in place of
+  // activations, see Precision
+  PoolVector<BFloat16> activationsBf16;
+
+  // summed over the batch, borrowed from Workspace::gradients
+  Matrix weightGradient;
+  Matrix biasGradient;
+};
+
+// Everything a forward/backward pass writes, so passes on separate
+// workspaces can run over one network at the same time. layers holds the
+// hidden layers, then the output layer. NeuralNetwork::plan_workspace()
+// sizes all of it up front.
+struct Workspace {
+  MatrixView inputs{nullptr, 0, 0, 0, 0}; // not copied, see forward()
+  std::vector<LayerWorkspace> layers;
+
+  // Backward only needs the deltas of two adjacent layers at once, so
+  // layer i uses deltas[i % 2]
+  Matrix deltas[2];
+  // In bf16 training the current layer's delta is worked out in deltas[0],
+  // then kept here for the GEMMs that read it
+  PoolVector<BFloat16> deltaBf16;
+
+  // Every layer's gradients in one buffer, laid out like the network's
+  // parameters, so reducing and applying them are flat passes
+  Matrix gradients;
+
+  // Bytes held by every buffer
+  size_t bytes() const {
+    size_t floats =
+        deltas[0].capacity() + deltas[1].capacity() + gradients.capacity();
+    size_t halves = deltaBf16.capacity();
+    for (const LayerWorkspace &lw : layers) {
+      floats += lw.z.capacity() + lw.activations.capacity();
+      halves += lw.activationsBf16.capacity();
+    }
+    return floats * sizeof(float) + halves * sizeof(BFloat16);
+  }
+};
+} // namespace Dendrite
+
+#endif // !WORKSPACE_H
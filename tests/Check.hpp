@@ -0,0 +1,71 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// Helpers shared by the check executables under tests/. A failed check
+// prints what it compared and is counted, and check_result() turns the
+// count into the exit status ctest looks at.
+namespace Check {
+inline size_t &failures() {
+  static size_t count = 0;
+  return count;
+}
+
+inline std::mt19937 &rng() {
+  static std::mt19937 gen(42);
+  return gen;
+}
+
+inline std::vector<float> random_floats(size_t n, float lo = -1.0f,
+                                        float hi = 1.0f) {
+  std::uniform_real_distribution<float> dist(lo, hi);
+  std::vector<float> v(n);
+  for (float &x : v)
+    x = dist(rng());
+  return v;
+}
+
+inline void expect(const char *what, bool ok) {
+  if (!ok) {
+    std::printf("FAIL %s\n", what);
+    failures()++;
+  }
+}
+
+// Every got[i] within tol * (1 + |want[i]|) of want[i]. Written so a NaN
+// never passes. Reports the first mismatch only.
+inline void expect_near(const char *what, const float *got, const float *want,
+                        size_t n, float tol) {
+  for (size_t i = 0; i < n; i++) {
+    if (!(std::fabs(got[i] - want[i]) <= tol * (1.0f + std::fabs(want[i])))) {
+      std::printf("FAIL %s: [%zu] = %g, want %g\n", what, i, got[i],
+                  want[i]);
+      failures()++;
+      return;
+    }
+  }
+}
+
+inline void expect_near(const char *what, const std::vector<float> &got,
+                        const std::vector<float> &want, float tol) {
+  expect("same length", got.size() == want.size());
+  expect_near(what, got.data(), want.data(), got.size(), tol);
+}
+
+inline int check_result() {
+  if (failures() > 0) {
+    std::printf("%zu checks failed\n", failures());
+    return EXIT_FAILURE;
+  }
+  std::printf("all checks passed\n");
+  return EXIT_SUCCESS;
+}
+} // namespace Check
+
+#endif // !CHECK_H
@@ -0,0 +1,454 @@
+// Checks the compute kernels against plain loops, exiting non-zero if any
+// result is off. ctest runs it once per DENDRITE_SIMD level; a level the
+// machine lacks is capped to the best one it has.
+#include "Check.hpp"
+#include "core/ThreadPool.hpp"
+#include "math/BFloat16.hpp"
+#include "math/Gemm.hpp"
+#include "math/PackedMatrix.hpp"
+#include "math/simd/Kernels.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace Dendrite;
+using Check::random_floats;
+
+namespace {
+// Float results may differ from the reference in summation order only
+float sum_tol(size_t k) { return 1e-6f * (float)(k + 16); }
+
+// Lengths around every vector width, for the loop tails
+const size_t LENGTHS[] = {0, 1, 3, 4, 7, 8, 15, 16, 17, 31, 33, 64, 100, 1001};
+
+void check_elementwise(size_t n) {
+  const Kernels &k = kernels();
+  const std::vector<float> x = random_floats(n);
+  const std::vector<float> y = random_floats(n);
+  const std::vector<float> pos = random_floats(n, 0.01f, 4.0f);
+  std::vector<float> want(n);
+  std::vector<float> got(n);
+
+  for (size_t i = 0; i < n; i++)
+    want[i] = x[i] * 1.5f;
+  k.scale(x.data(), 1.5f, got.data(), n);
+  Check::expect_near("scale", got, want, 0.0f);
+
+  for (size_t i = 0; i < n; i++)
+    want[i] = x[i] + 0.25f;
+  k.add_scalar(x.data(), 0.25f, got.data(), n);
+  Check::expect_near("add_scalar", got, want, 0.0f);
+
+  for (size_t i = 0; i < n; i++)
+    want[i] = x[i] + y[i];
+  k.add(x.data(), y.data(), got.data(), n);
+  Check::expect_near("add", got, want, 0.0f);
+
+  for (size_t i = 0; i < n; i++)
+    want[i] = x[i] * y[i];
+  k.mul(x.data(), y.data(), got.data(), n);
+  Check::expect_near("mul", got, want, 0.0f);
+
+  // may be fused into one rounding
+  for (size_t i = 0; i < n; i++)
+    want[i] = y[i] + 0.75f * x[i];
+  got = y;
+  k.axpy(0.75f, x.data(), got.data(), n);
+  Check::expect_near("axpy", got, want, 1e-6f);
+
+  for (float p : {2.0f, 3.0f, 0.5f}) {
+    for (size_t i = 0; i < n; i++)
+      want[i] = std::pow(pos[i], p);
+    k.pow(pos.data(), p, got.data(), n);
+    Check::expect_near("pow", got, want, 1e-6f);
+  }
+
+  // out may alias an input
+  for (size_t i = 0; i < n; i++)
+    want[i] = x[i] * y[i];
+  got = x;
+  k.mul(got.data(), y.data(), got.data(), n);
+  Check::expect_near("mul in place", got, want, 0.0f);
+}
+
+// exp within 2e-7 relative error of a double precision exp over the whole
+// unclamped range, as FastExp.hpp promises
+void check_exp(size_t n) {
+  std::vector<float> x = random_floats(n, -87.0f, 88.0f);
+  if (n >= 3) {
+    x[0] = -87.0f;
+    x[1] = 0.0f;
+    x[2] = 88.0f;
+  }
+  std::vector<float> got(n);
+  kernels().exp(x.data(), got.data(), n);
+
+  for (size_t i = 0; i < n; i++) {
+    const double want = std::exp((double)x[i]);
+    const double err = std::fabs(got[i] - want) / want;
+    if (!(err < 2e-7)) {
+      std::printf("FAIL exp: exp(%g) = %g, relative error %g\n", x[i],
+                  got[i], err);
+      Check::failures()++;
+      return;
+    }
+  }
+}
+
+void check_activations(size_t n) {
+  const Kernels &k = kernels();
+  std::vector<float> x = random_floats(n, -20.0f, 20.0f);
+  // ReLU's derivative at 0 is taken as 1
+  for (size_t i = 0; i < n; i += 5)
+    x[i] = 0.0f;
+  std::vector<float> want(n);
+  std::vector<float> got(n);
+
+  for (size_t i = 0; i < n; i++)
+    want[i] = (float)(1.0 / (1.0 + std::exp(-(double)x[i])));
+  k.sigmoid(x.data(), got.data(), n);
+  Check::expect_near("sigmoid", got, want, 1e-6f);
+
+  for (size_t i = 0; i < n; i++)
+    want[i] = want[i] * (1.0f - want[i]);
+  k.sigmoid_deriv(x.data(), got.data(), n);
+  Check::expect_near("sigmoid_deriv", got, want, 1e-6f);
+
+  for (size_t i = 0; i < n; i++)
+    want[i] = x[i] >= 0.0f ? x[i] : 0.0f;
+  k.relu(x.data(), got.data(), n);
+  Check::expect_near("relu", got, want, 0.0f);
+
+  for (size_t i = 0; i < n; i++)
+    want[i] = x[i] >= 0.0f ? 1.0f : 0.0f;
+  k.relu_deriv(x.data(), got.data(), n);
+  Check::expect_near("relu_deriv", got, want, 0.0f);
+}
+
+// vec_* follow math_mode(): EXACT matches std::exp bit for bit, FAST is
+// the level's kernel
+void check_math_modes(size_t n) {
+  const std::vector<float> x = random_floats(n, -20.0f, 20.0f);
+  std::vector<float> want(n);
+  std::vector<float> got(n);
+  const MathMode mode = math_mode();
+
+  set_math_mode(MathMode::EXACT);
+  for (size_t i = 0; i < n; i++)
+    want[i] = std::exp(x[i]);
+  vec_exp(x.data(), got.data(), n);
+  Check::expect_near("exact vec_exp", got, want, 0.0f);
+
+  for (size_t i = 0; i < n; i++)
+    want[i] = 1.0f / (1.0f + std::exp(-x[i]));
+  vec_sigmoid(x.data(), got.data(), n);
+  Check::expect_near("exact vec_sigmoid", got, want, 0.0f);
+
+  for (size_t i = 0; i < n; i++)
+    want[i] = want[i] * (1.0f - want[i]);
+  vec_sigmoid_deriv(x.data(), got.data(), n);
+  Check::expect_near("exact vec_sigmoid_deriv", got, want, 0.0f);
+
+  set_math_mode(MathMode::FAST);
+  kernels().exp(x.data(), want.data(), n);
+  vec_exp(x.data(), got.data(), n);
+  Check::expect_near("fast vec_exp", got, want, 0.0f);
+
+  kernels().sigmoid(x.data(), want.data(), n);
+  vec_sigmoid(x.data(), got.data(), n);
+  Check::expect_near("fast vec_sigmoid", got, want, 0.0f);
+
+  kernels().sigmoid_deriv(x.data(), want.data(), n);
+  vec_sigmoid_deriv(x.data(), got.data(), n);
+  Check::expect_near("fast vec_sigmoid_deriv", got, want, 0.0f);
+
+  set_math_mode(mode);
+}
+
+// Three momentum steps against the update rule, in double
+void check_momentum(size_t n, bool nesterov) {
+  const MomentumStep step{0.25f, 0.1f, 0.9f, nesterov};
+  std::vector<float> w = random_floats(n);
+  std::vector<float> v(n, 0.0f);
+  std::vector<double> wantW(w.begin(), w.end());
+  std::vector<double> wantV(n, 0.0);
+
+  for (int t = 0; t < 3; t++) {
+    const std::vector<float> g = random_floats(n);
+    for (size_t i = 0; i < n; i++) {
+      const double gi = 0.25 * g[i];
+      wantV[i] = 0.9 * wantV[i] + gi;
+      wantW[i] -= 0.1 * (nesterov ? gi + 0.9 * wantV[i] : wantV[i]);
+    }
+    kernels().momentum(step, g.data(), v.data(), w.data(), n);
+  }
+
+  const char *what = nesterov ? "nesterov momentum" : "momentum";
+  Check::expect_near(what, v, std::vector<float>(wantV.begin(), wantV.end()),
+                     1e-6f);
+  Check::expect_near(what, w, std::vector<float>(wantW.begin(), wantW.end()),
+                     1e-6f);
+}
+
+// Three Adam steps against the update rule, in double. l2 folds the decay
+// into the gradient (Adam), decay applies it to the weights after the
+// step (AdamW).
+void check_adam(size_t n, float l2, float decay) {
+  const double lr = 0.01, beta1 = 0.9, beta2 = 0.999, eps = 1e-8;
+  std::vector<float> w = random_floats(n);
+  std::vector<float> m(n, 0.0f);
+  std::vector<float> v(n, 0.0f);
+  std::vector<double> wantW(w.begin(), w.end());
+  std::vector<double> wantM(n, 0.0);
+  std::vector<double> wantV(n, 0.0);
+
+  for (int t = 1; t <= 3; t++) {
+    const AdamStep step{0.5f,
+                        (float)beta1,
+                        (float)beta2,
+                        (float)eps,
+                        l2,
+                        decay,
+                        (float)(lr / (1.0 - std::pow(beta1, t))),
+                        (float)(1.0 / (1.0 - std::pow(beta2, t)))};
+    const std::vector<float> g = random_floats(n);
+    for (size_t i = 0; i < n; i++) {
+      const double gi = 0.5 * g[i] + l2 * wantW[i];
+      wantM[i] = beta1 * wantM[i] + (1.0 - beta1) * gi;
+      wantV[i] = beta2 * wantV[i] + (1.0 - beta2) * gi * gi;
+      const double mHat = wantM[i] / (1.0 - std::pow(beta1, t));
+      const double vHat = wantV[i] / (1.0 - std::pow(beta2, t));
+      wantW[i] -= lr * mHat / (std::sqrt(vHat) + eps) + decay * wantW[i];
+    }
+    kernels().adam(step, g.data(), m.data(), v.data(), w.data(), n);
+  }
+
+  const char *what = decay != 0.0f ? "adamw" : l2 != 0.0f ? "adam l2" : "adam";
+  Check::expect_near(what, m, std::vector<float>(wantM.begin(), wantM.end()),
+                     1e-6f);
+  Check::expect_near(what, v, std::vector<float>(wantV.begin(), wantV.end()),
+                     1e-6f);
+  Check::expect_near(what, w, std::vector<float>(wantW.begin(), wantW.end()),
+                     1e-5f);
+}
+
+// C = 0.5 * A * B + 0.25 * C, with A row-major or transposed and B
+// row-major, against gemm_naive
+void check_gemm(const char *what, size_t m, size_t n, size_t k,
+                bool transA) {
+  const std::vector<float> a = random_floats(m * k);
+  const std::vector<float> b = random_floats(k * n);
+  const size_t rsa = transA ? 1 : k;
+  const size_t csa = transA ? m : 1;
+
+  std::vector<float> want = random_floats(m * n);
+  std::vector<float> got = want;
+  gemm_naive(m, n, k, 0.5f, a.data(), rsa, csa, b.data(), n, 1, 0.25f,
+             want.data(), n, 1);
+  gemm(m, n, k, 0.5f, a.data(), rsa, csa, b.data(), n, 1, 0.25f, got.data(),
+       n, 1);
+  Check::expect_near(what, got, want, sum_tol(k));
+}
+
+// The vector bf16 conversions against the scalar ones, bit for bit. A few
+// NaNs and halfway cases are mixed in.
+void check_bf16(size_t n) {
+  std::vector<float> x = random_floats(n, -1e4f, 1e4f);
+  for (size_t i = 0; i < n; i += 7)
+    x[i] = i % 2 == 0 ? std::nanf("") : 1.0f + 1.0f / 256.0f;
+  std::vector<BFloat16> got(n);
+  kernels().to_bf16(x.data(), got.data(), n);
+  bool same = true;
+  for (size_t i = 0; i < n; i++)
+    same &= got[i].bits == to_bf16(x[i]).bits;
+  Check::expect("to_bf16", same);
+
+  std::vector<float> wide(n);
+  std::vector<float> want(n);
+  kernels().from_bf16(got.data(), wide.data(), n);
+  for (size_t i = 0; i < n; i++)
+    want[i] = to_float(got[i]);
+  same = true;
+  for (size_t i = 0; i < n; i++)
+    same &= std::memcmp(&wide[i], &want[i], sizeof(float)) == 0;
+  Check::expect("from_bf16", same);
+}
+
+// C = 0.5 * A * B + 0.25 * C with a bf16 B and a bf16 or fp32 A, against
+// gemm_naive on the values the bf16 operands round to
+void check_gemm_mixed(size_t m, size_t n, size_t k, bool bf16A) {
+  std::vector<float> a = random_floats(m * k);
+  std::vector<float> b = random_floats(k * n);
+  std::vector<BFloat16> a16(a.size());
+  std::vector<BFloat16> b16(b.size());
+  for (size_t i = 0; bf16A && i < a.size(); i++) {
+    a16[i] = to_bf16(a[i]);
+    a[i] = to_float(a16[i]);
+  }
+  for (size_t i = 0; i < b.size(); i++) {
+    b16[i] = to_bf16(b[i]);
+    b[i] = to_float(b16[i]);
+  }
+
+  std::vector<float> want = random_floats(m * n);
+  std::vector<float> got = want;
+  gemm_naive(m, n, k, 0.5f, a.data(), k, 1, b.data(), n, 1, 0.25f,
+             want.data(), n, 1);
+  const GemmOperand opA = bf16A ? GemmOperand{nullptr, a16.data(), k, 1}
+                                : GemmOperand{a.data(), nullptr, k, 1};
+  gemm_mixed(m, n, k, 0.5f, opA, {nullptr, b16.data(), n, 1}, 0.25f,
+             got.data(), n, 1);
+  Check::expect_near("gemm_mixed", got, want, sum_tol(k));
+}
+
+// A sparse rows x k matrix, about one entry in density nonzero, times a
+// dense k x n one with padded rows
+void check_spmm_csr(size_t rows, size_t n, size_t k, float density) {
+  std::bernoulli_distribution keep(density);
+  std::vector<uint32_t> rowStart = {0};
+  std::vector<uint32_t> colIndex;
+  std::vector<float> values;
+  std::vector<float> dense(rows * k, 0.0f);
+  for (size_t r = 0; r < rows; r++) {
+    for (size_t p = 0; p < k; p++) {
+      if (keep(Check::rng())) {
+        colIndex.push_back((uint32_t)p);
+        values.push_back(random_floats(1)[0]);
+        dense[r * k + p] = values.back();
+      }
+    }
+    rowStart.push_back((uint32_t)values.size());
+  }
+
+  const size_t ldb = n + 5;
+  const size_t ldc = n + 3;
+  const std::vector<float> b = random_floats(k * ldb);
+  std::vector<float> want(rows * ldc, 0.0f);
+  for (size_t r = 0; r < rows; r++)
+    for (size_t j = 0; j < n; j++)
+      for (size_t p = 0; p < k; p++)
+        want[r * ldc + j] += dense[r * k + p] * b[p * ldb + j];
+
+  // the padding past n must come back untouched
+  std::vector<float> got = want;
+  for (size_t r = 0; r < rows; r++)
+    for (size_t j = 0; j < n; j++)
+      got[r * ldc + j] = NAN;
+  kernels().spmm_csr(rows, n, rowStart.data(), colIndex.data(),
+                     values.data(), b.data(), ldb, got.data(), ldc);
+  Check::expect_near("spmm_csr", got, want, sum_tol(k));
+}
+
+// Integer products are exact, so compared bit for bit, with the padding
+// past cols in each output row left alone
+void check_dot_u8s8(size_t rows, size_t cols, size_t k) {
+  std::uniform_int_distribution<int> dist(0, 255);
+  std::vector<int8_t> w(rows * k);
+  std::vector<uint8_t> x(k * cols);
+  for (int8_t &v : w)
+    v = (int8_t)(dist(Check::rng()) - 128);
+  for (uint8_t &v : x)
+    v = (uint8_t)dist(Check::rng());
+
+  const size_t ldo = cols + 3;
+  std::vector<int32_t> want(rows * ldo, -1);
+  for (size_t r = 0; r < rows; r++) {
+    for (size_t j = 0; j < cols; j++) {
+      int32_t sum = 0;
+      for (size_t p = 0; p < k; p++)
+        sum += w[r * k + p] * x[((p / 4) * cols + j) * 4 + p % 4];
+      want[r * ldo + j] = sum;
+    }
+  }
+
+  std::vector<int32_t> got(rows * ldo, -1);
+  kernels().dot_u8s8(rows, cols, k, w.data(), x.data(), got.data(), ldo);
+  Check::expect("dot_u8s8", got == want);
+}
+
+// y = W * x through a PackedMatrix, with W packed from a row-major or a
+// transposed view
+void check_gemv_packed(size_t rows, size_t k, bool transW) {
+  const std::vector<float> w = random_floats(rows * k);
+  const std::vector<float> x = random_floats(k);
+  const size_t rsw = transW ? 1 : k;
+  const size_t csw = transW ? rows : 1;
+  std::vector<float> want(rows, 0.0f);
+  for (size_t r = 0; r < rows; r++)
+    for (size_t p = 0; p < k; p++)
+      want[r] += w[r * rsw + p * csw] * x[p];
+
+  const PackedMatrix packed(MatrixView(w.data(), rows, k, rsw, csw));
+  std::vector<float> got(rows);
+  packed.gemv(x.data(), got.data());
+  Check::expect_near("gemv_packed", got, want, sum_tol(k));
+}
+
+// odd sizes cover the register tile and cache block edges
+const size_t GEMM_SIZES[][3] = {{1, 1, 1},      {3, 5, 7},    {16, 16, 16},
+                                {17, 33, 9},    {64, 1, 300}, {1, 64, 300},
+                                {100, 70, 300}, {130, 257, 65}};
+} // namespace
+
+int main() {
+  std::printf("kernels: %s, gemm: %s\n", simd_level_name(kernels().level),
+              gemm_kernel().name);
+
+  // DENDRITE_MATH picks the starting mode
+  const char *mathEnv = std::getenv("DENDRITE_MATH");
+  const bool exactEnv =
+      mathEnv != nullptr && std::strcmp(mathEnv, "exact") == 0;
+  Check::expect("DENDRITE_MATH",
+                math_mode() == (exactEnv ? MathMode::EXACT : MathMode::FAST));
+
+  for (size_t n : LENGTHS) {
+    check_elementwise(n);
+    check_exp(n);
+    check_activations(n);
+    check_math_modes(n);
+    check_momentum(n, false);
+    check_momentum(n, true);
+    check_adam(n, 0.0f, 0.0f);
+    check_adam(n, 0.01f, 0.0f);
+    check_adam(n, 0.0f, 1e-4f);
+    check_bf16(n);
+  }
+
+  for (const auto &s : GEMM_SIZES) {
+    check_gemm("gemm", s[0], s[1], s[2], false);
+    check_gemm("gemm", s[0], s[1], s[2], true);
+    check_gemm_mixed(s[0], s[1], s[2], false);
+    check_gemm_mixed(s[0], s[1], s[2], true);
+  }
+
+  // with the threshold at 1 every product is split across the pool, down
+  // to grids of a single block
+  set_num_threads(4);
+  const size_t threshold = gemm_parallel_threshold();
+  set_gemm_parallel_threshold(1);
+  for (const auto &s : GEMM_SIZES) {
+    check_gemm("gemm_parallel", s[0], s[1], s[2], false);
+    check_gemm("gemm_parallel", s[0], s[1], s[2], true);
+  }
+  set_gemm_parallel_threshold(threshold);
+
+  for (size_t rows : {1, 13, 64, 130})
+    for (size_t k : {1, 37, 300}) {
+      check_gemv_packed(rows, k, false);
+      check_gemv_packed(rows, k, true);
+    }
+
+  for (size_t rows : {1, 5, 33})
+    for (size_t cols : {16, 48})
+      for (size_t k : {4, 64, 260})
+        check_dot_u8s8(rows, cols, k);
+
+  for (size_t n : {1, 7, 16, 33, 64, 100})
+    for (float density : {0.0f, 0.1f, 0.5f})
+      check_spmm_csr(37, n, 90, density);
+
+  return Check::check_result();
+}
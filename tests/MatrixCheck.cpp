@@ -0,0 +1,91 @@
+// Checks Matrix views and expressions against the eager Matrix API,
+// exiting non-zero if any result is off.
+#include "Check.hpp"
+#include "math/Matrix.hpp"
+#include <cstdio>
+#include <vector>
+
+using namespace Dendrite;
+
+namespace {
+Matrix random_matrix(size_t rows, size_t cols) {
+  Matrix m(rows, cols);
+  const std::vector<float> v = Check::random_floats(rows * cols);
+  for (size_t i = 0; i < v.size(); i++)
+    m.set_data(i, v[i]);
+  return m;
+}
+
+void expect_equal(const char *what, const Matrix &got, const Matrix &want) {
+  if (got.rows() != want.rows() || got.cols() != want.cols()) {
+    std::printf("FAIL %s: %zux%zu, want %zux%zu\n", what, got.rows(),
+                got.cols(), want.rows(), want.cols());
+    Check::failures()++;
+    return;
+  }
+  Check::expect_near(what, got.data(), want.data(), got.size(), 0.0f);
+}
+
+// Assignments whose right-hand side reads the destination out of place
+void check_self_assignment(size_t rows, size_t cols) {
+  Matrix m = random_matrix(rows, cols);
+  Matrix want = m.transpose();
+  m = m.view().transpose();
+  expect_equal("m = m^T", m, want);
+
+  m = random_matrix(rows, cols);
+  want = Matrix(m.block(1, 1, rows - 1, cols - 1));
+  m = m.block(1, 1, rows - 1, cols - 1);
+  expect_equal("m = block of m", m, want);
+
+  m = random_matrix(rows, cols);
+  want = Matrix(m.col(cols - 1));
+  m = m.col(cols - 1);
+  expect_equal("m = column of m", m, want);
+
+  // a prefix of m reads each element before it's written
+  m = random_matrix(rows, cols);
+  want = Matrix(m.row(0));
+  m = m.row(0);
+  expect_equal("m = first row of m", m, want);
+}
+
+void check_square_self_updates(size_t n) {
+  Matrix m = random_matrix(n, n);
+  Matrix want = m.transpose().add(m).scale(2.0f);
+  m = (m.view().transpose() + m) * 2.0f;
+  expect_equal("m = (m^T + m) * 2", m, want);
+
+  m = random_matrix(n, n);
+  want = m.add(m.transpose());
+  m += m.view().transpose();
+  expect_equal("m += m^T", m, want);
+
+  m = random_matrix(n, n);
+  want = Matrix(m).add(m.transpose().scale(-1.0f));
+  m -= m.view().transpose();
+  expect_equal("m -= m^T", m, want);
+
+  m = random_matrix(n, n);
+  want = m.transpose();
+  m.set_data_from(m.view().transpose());
+  expect_equal("set_data_from(m^T)", m, want);
+
+  // reads in place, so no copy is needed
+  m = random_matrix(n, n);
+  want = m.scale(3.0f);
+  m = m * 2.0f + m;
+  expect_equal("m = m * 2 + m", m, want);
+}
+} // namespace
+
+int main() {
+  check_self_assignment(2, 3);
+  check_self_assignment(3, 2);
+  check_self_assignment(3, 3);
+  check_self_assignment(17, 33);
+  check_square_self_updates(3);
+  check_square_self_updates(16);
+
+  return Check::check_result();
+}
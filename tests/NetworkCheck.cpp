@@ -0,0 +1,120 @@
+// Checks whole networks on synthetic data: the int8 QuantizedNetwork
+// against the fp32 network it was quantized from, pruned networks on the
+// sparse kernels against the dense ones, and save/load round trips. Exits
+// non-zero if any result is off.
+#include "Check.hpp"
+#include "core/dendrite.hpp"
+#include "nn/NeuralNetwork.hpp"
+#include "nn/QuantizedNetwork.hpp"
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace Dendrite;
+
+namespace {
+Matrix random_matrix(size_t rows, size_t cols, float lo, float hi) {
+  Matrix m(rows, cols);
+  m.set_data(Check::random_floats(rows * cols, lo, hi));
+  return m;
+}
+
+std::filesystem::path temp_path(const char *name) {
+  return std::filesystem::temp_directory_path() / name;
+}
+
+// Int8 weights and inputs cost up to a few percent of the output range on
+// the odd output and well under one percent on average. The reloaded model
+// must match to the bit.
+void check_quantized(const NeuralNetwork &net, const Matrix &inputs) {
+  Workspace ws;
+  Matrix want;
+  net.forward_batch(inputs, want, ws);
+  const QuantizedNetwork quantized = QuantizedNetwork::quantize(net, inputs);
+  const Matrix got = quantized.forward(inputs);
+  Check::expect("quantized shape",
+                got.rows() == want.rows() && got.cols() == want.cols());
+  Check::expect_near("quantized forward", got.data(), want.data(),
+                     want.size(), 0.1f);
+  double meanError = 0.0;
+  for (size_t i = 0; i < want.size(); i++)
+    meanError += std::fabs(got.data()[i] - want.data()[i]) / want.size();
+  Check::expect("quantized mean error", meanError < 0.01);
+
+  const std::filesystem::path path = temp_path("dendrite-check.qdm");
+  quantized.save(path);
+  QuantizedNetwork loaded;
+  loaded.load(path);
+  std::filesystem::remove(path);
+  const Matrix reloaded = loaded.forward(inputs);
+  Check::expect("quantized load shape", reloaded.size() == got.size());
+  Check::expect_near("quantized load", reloaded.data(), got.data(),
+                     got.size(), 0.0f);
+}
+
+// Prunes the hidden layers to 90%, then checks the frozen (CSR) forward
+// pass against the dense one and a save/load round trip. Past 65536 inputs
+// the first layer's column indices are stored as 32 bits instead of 16.
+void check_pruned(size_t numInputs) {
+  NeuralNetwork net("quadratic");
+  net.set_input_layer(numInputs);
+  net.add_hidden_layer(16, "relu");
+  net.add_hidden_layer(12, "sigmoid");
+  net.set_output_layer(5, "sigmoid");
+  net.init();
+  const Matrix inputs = random_matrix(numInputs, 7, 0.0f, 1.0f);
+
+  net.prune(0.9f);
+  Check::expect("pruned sparsity", net.layer(0).sparsity() >= 0.89f &&
+                                       net.layer(1).sparsity() >= 0.89f);
+  Workspace ws;
+  Matrix dense;
+  net.forward_batch(inputs, dense, ws);
+
+  net.freeze();
+  Check::expect("pruned storage", net.layer(0).sparse_storage());
+  Matrix sparse;
+  net.forward_batch(inputs, sparse, ws);
+  Check::expect_near("pruned forward", sparse.data(), dense.data(),
+                     dense.size(), 1e-5f);
+
+  const std::filesystem::path path = temp_path("dendrite-check.dm");
+  net.save(path);
+  std::string magic(18, '\0');
+  std::ifstream(path, std::ios::binary).read(magic.data(), magic.size());
+  Check::expect("pruned file format",
+                magic == std::string("DENDRITE_MODEL_V2\0", 18));
+
+  NeuralNetwork loaded;
+  loaded.load(path);
+  std::filesystem::remove(path);
+  Check::expect("pruned load frozen", loaded.frozen());
+  Matrix reloaded;
+  loaded.forward_batch(inputs, reloaded, ws);
+  Check::expect("pruned load shape", reloaded.size() == sparse.size());
+  Check::expect_near("pruned load", reloaded.data(), sparse.data(),
+                     sparse.size(), 1e-6f);
+}
+} // namespace
+
+int main() {
+  init_functions();
+
+  NeuralNetwork net("quadratic");
+  net.set_input_layer(40);
+  net.add_hidden_layer(24, "relu");
+  net.add_hidden_layer(16, "sigmoid");
+  net.set_output_layer(10, "sigmoid");
+  net.init();
+
+  // inputs in [0, 1], as for image pixels
+  const Matrix inputs = random_matrix(40, 300, 0.0f, 1.0f);
+  check_quantized(net, inputs);
+
+  check_pruned(40);
+  check_pruned(65537);
+
+  return Check::check_result();
+}